@@ -0,0 +1,325 @@
+/*
+	Block container: block_list always keeps the blocks in address order;
+	VMA_CONTAINER picks what finds a block by address. VMA_LIST walks the
+	list, VMA_ARRAY keeps a sorted array of the block nodes (binary search,
+	insertions move the tail), VMA_TREE an AVL tree of them with subtree
+	counts for the position. The key is the live start_address of a block:
+	blocks never overlap, so their order holds while merges and splits move
+	the starts, and only added and removed blocks touch the index.
+*/
+#include "vma.h"
+
+static uint64_t key(const node_t *b_node)
+{
+	return ((const block_t *)b_node->info)->start_address;
+}
+
+#if VMA_CONTAINER == VMA_ARRAY
+
+struct block_index_t {
+	node_t **blocks;
+	uint64_t len;
+	uint64_t cap;
+};
+
+// number of blocks starting at or before address
+static uint64_t count_before(const block_index_t *index, uint64_t address)
+{
+	uint64_t lo = 0, hi = index->len;
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		if (key(index->blocks[mid]) <= address)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+block_index_t *block_index_create(void)
+{
+	block_index_t *index = calloc(1, sizeof(*index));
+	if (!index) {
+		fprintf(stderr, "Malloc failed!\n");
+		exit(1);
+	}
+	return index;
+}
+
+void block_index_free(arena_t *arena)
+{
+	free(arena->block_index->blocks);
+	free(arena->block_index);
+	arena->block_index = NULL;
+}
+
+void block_index_insert(arena_t *arena, node_t *b_node)
+{
+	block_index_t *index = arena->block_index;
+	if (index->len == index->cap) {
+		index->cap = index->cap ? 2 * index->cap : 16;
+		index->blocks = realloc(index->blocks,
+								index->cap * sizeof(node_t *));
+		if (!index->blocks) {
+			fprintf(stderr, "Malloc failed!\n");
+			exit(1);
+		}
+	}
+	uint64_t i = count_before(index, key(b_node));
+	memmove(&index->blocks[i + 1], &index->blocks[i],
+			(index->len - i) * sizeof(node_t *));
+	index->blocks[i] = b_node;
+	index->len++;
+}
+
+void block_index_remove(arena_t *arena, node_t *b_node)
+{
+	block_index_t *index = arena->block_index;
+	uint64_t i = count_before(index, key(b_node)) - 1;
+	memmove(&index->blocks[i], &index->blocks[i + 1],
+			(index->len - i - 1) * sizeof(node_t *));
+	index->len--;
+}
+
+node_t *block_index_floor(const arena_t *arena, uint64_t address,
+						  uint64_t *pos)
+{
+	uint64_t i = count_before(arena->block_index, address);
+	if (!i)
+		return NULL;
+	if (pos)
+		*pos = i - 1;
+	return arena->block_index->blocks[i - 1];
+}
+
+void block_index_memory(const arena_t *arena, uint64_t *used, uint64_t *heap)
+{
+	const block_index_t *index = arena->block_index;
+	*used = sizeof(*index) + index->len * sizeof(node_t *);
+	*heap = malloc_footprint(sizeof(*index)) +
+			(index->cap ? malloc_footprint(index->cap * sizeof(node_t *)) : 0);
+}
+
+#elif VMA_CONTAINER == VMA_TREE
+
+typedef struct tree_node_t {
+	node_t *b_node;
+	struct tree_node_t *left, *right;
+	int height;
+	// nodes of the subtree, for the position of a block
+	uint64_t count;
+} tree_node_t;
+
+struct block_index_t {
+	tree_node_t *root;
+};
+
+static int height(const tree_node_t *t)
+{
+	return t ? t->height : 0;
+}
+
+static uint64_t count(const tree_node_t *t)
+{
+	return t ? t->count : 0;
+}
+
+static void update(tree_node_t *t)
+{
+	int hl = height(t->left), hr = height(t->right);
+	t->height = (hl > hr ? hl : hr) + 1;
+	t->count = count(t->left) + count(t->right) + 1;
+}
+
+static tree_node_t *rotate_right(tree_node_t *t)
+{
+	tree_node_t *l = t->left;
+	t->left = l->right, l->right = t;
+	update(t), update(l);
+	return l;
+}
+
+static tree_node_t *rotate_left(tree_node_t *t)
+{
+	tree_node_t *r = t->right;
+	t->right = r->left, r->left = t;
+	update(t), update(r);
+	return r;
+}
+
+// restores the AVL rule at t, whose subtrees differ in height by 2 at most
+static tree_node_t *balance(tree_node_t *t)
+{
+	update(t);
+	if (height(t->left) > height(t->right) + 1) {
+		if (height(t->left->left) < height(t->left->right))
+			t->left = rotate_left(t->left);
+		return rotate_right(t);
+	}
+	if (height(t->right) > height(t->left) + 1) {
+		if (height(t->right->right) < height(t->right->left))
+			t->right = rotate_right(t->right);
+		return rotate_left(t);
+	}
+	return t;
+}
+
+static tree_node_t *tree_insert(tree_node_t *t, tree_node_t *new_node)
+{
+	if (!t)
+		return new_node;
+	if (key(new_node->b_node) < key(t->b_node))
+		t->left = tree_insert(t->left, new_node);
+	else
+		t->right = tree_insert(t->right, new_node);
+	return balance(t);
+}
+
+// unlinks the leftmost node of t into *min
+static tree_node_t *tree_remove_min(tree_node_t *t, tree_node_t **min)
+{
+	if (!t->left) {
+		*min = t;
+		return t->right;
+	}
+	t->left = tree_remove_min(t->left, min);
+	return balance(t);
+}
+
+static tree_node_t *tree_remove(tree_node_t *t, const node_t *b_node)
+{
+	if (!t)
+		return NULL;
+	if (t->b_node == b_node) {
+		tree_node_t *l = t->left, *r = t->right, *min;
+		free(t);
+		if (!r)
+			return l;
+		r = tree_remove_min(r, &min);
+		min->left = l, min->right = r;
+		return balance(min);
+	}
+	if (key(b_node) < key(t->b_node))
+		t->left = tree_remove(t->left, b_node);
+	else
+		t->right = tree_remove(t->right, b_node);
+	return balance(t);
+}
+
+static void tree_free(tree_node_t *t)
+{
+	if (!t)
+		return;
+	tree_free(t->left);
+	tree_free(t->right);
+	free(t);
+}
+
+block_index_t *block_index_create(void)
+{
+	block_index_t *index = calloc(1, sizeof(*index));
+	if (!index) {
+		fprintf(stderr, "Malloc failed!\n");
+		exit(1);
+	}
+	return index;
+}
+
+void block_index_free(arena_t *arena)
+{
+	tree_free(arena->block_index->root);
+	free(arena->block_index);
+	arena->block_index = NULL;
+}
+
+void block_index_insert(arena_t *arena, node_t *b_node)
+{
+	tree_node_t *new_node = malloc(sizeof(*new_node));
+	if (!new_node) {
+		fprintf(stderr, "Malloc failed!\n");
+		exit(1);
+	}
+	new_node->b_node = b_node;
+	new_node->left = NULL, new_node->right = NULL;
+	new_node->height = 1, new_node->count = 1;
+	arena->block_index->root = tree_insert(arena->block_index->root, new_node);
+}
+
+void block_index_remove(arena_t *arena, node_t *b_node)
+{
+	arena->block_index->root = tree_remove(arena->block_index->root, b_node);
+}
+
+node_t *block_index_floor(const arena_t *arena, uint64_t address,
+						  uint64_t *pos)
+{
+	const tree_node_t *t = arena->block_index->root, *found = NULL;
+	uint64_t before = 0, found_pos = 0;
+	while (t) {
+		if (key(t->b_node) <= address) {
+			found = t, found_pos = before + count(t->left);
+			before = found_pos + 1;
+			t = t->right;
+		} else {
+			t = t->left;
+		}
+	}
+	if (!found)
+		return NULL;
+	if (pos)
+		*pos = found_pos;
+	return found->b_node;
+}
+
+void block_index_memory(const arena_t *arena, uint64_t *used, uint64_t *heap)
+{
+	uint64_t n = count(arena->block_index->root);
+	*used = sizeof(block_index_t) + n * sizeof(tree_node_t);
+	*heap = malloc_footprint(sizeof(block_index_t)) +
+			n * malloc_footprint(sizeof(tree_node_t));
+}
+
+#else
+
+// VMA_LIST: no index, the lookups walk block_list
+block_index_t *block_index_create(void)
+{
+	return NULL;
+}
+
+void block_index_free(arena_t *arena)
+{
+	(void)arena;
+}
+
+void block_index_insert(arena_t *arena, node_t *b_node)
+{
+	(void)arena, (void)b_node;
+}
+
+void block_index_remove(arena_t *arena, node_t *b_node)
+{
+	(void)arena, (void)b_node;
+}
+
+node_t *block_index_floor(const arena_t *arena, uint64_t address,
+						  uint64_t *pos)
+{
+	node_t *bsearch = arena->block_list->head, *found = NULL;
+	uint64_t i = 0;
+	while (bsearch && key(bsearch) <= address) {
+		found = bsearch;
+		if (pos)
+			*pos = i;
+		bsearch = bsearch->next, i++;
+	}
+	return found;
+}
+
+void block_index_memory(const arena_t *arena, uint64_t *used, uint64_t *heap)
+{
+	(void)arena;
+	*used = 0, *heap = 0;
+}
+
+#endif
@@ -0,0 +1,73 @@
+/*
+	Consistency check of the arena lists, run after every command by the
+	debug build (make debug), so a broken merge or split is caught at the
+	command that caused it
+*/
+#include "vma.h"
+
+static bool check_failed(const char *reason, uint64_t address)
+{
+	fprintf(stderr, "Arena check failed: %s at 0x%lX\n", reason, address);
+	return false;
+}
+
+bool check_arena(const arena_t *arena)
+{
+	uint64_t num_blocks = 0, num_miniblocks = 0, used_mem = 0, pos;
+	node_t *bprev = NULL, *bsearch = arena->block_list->head;
+	block_t *last = NULL;
+	while (bsearch) {
+		block_t *block = (block_t *)bsearch->info;
+		if (bsearch->prev != bprev)
+			return check_failed("broken block links", block->start_address);
+		// sorted and never adjacent: adjacent blocks must have been merged
+		if (last && last->start_address + last->size >= block->start_address)
+			return check_failed("unmerged or overlapping blocks",
+								block->start_address);
+		if (block->start_address + block->size > arena->arena_size)
+			return check_failed("block past the arena", block->start_address);
+		// the block index gives every block at its place in the list
+		if (block_index_floor(arena, block->start_address, &pos) != bsearch ||
+			pos != num_blocks)
+			return check_failed("block index out of step",
+								block->start_address);
+
+		uint64_t count = 0, address = block->start_address;
+		node_t *mprev = NULL, *msearch = block->miniblock_list->head;
+		if (!msearch)
+			return check_failed("empty block", block->start_address);
+		while (msearch) {
+			miniblock_t *miniblock = (miniblock_t *)msearch->info;
+			if (msearch->prev != mprev)
+				return check_failed("broken miniblock links", address);
+			// miniblocks cover the block zone without holes
+			if (miniblock->start_address != address)
+				return check_failed("miniblock out of place", address);
+			if (!miniblock->rw_buffer)
+				return check_failed("miniblock without buffer", address);
+			if (arena->mapping && (char *)miniblock->rw_buffer !=
+								  arena->mapping + miniblock->start_address)
+				return check_failed("buffer out of its zone", address);
+			address += miniblock->size;
+			count++;
+			mprev = msearch;
+			msearch = msearch->next;
+		}
+		if (count != block->miniblock_list->num_nodes)
+			return check_failed("wrong miniblock count", block->start_address);
+		if (address != block->start_address + block->size)
+			return check_failed("wrong block size", block->start_address);
+		num_miniblocks += count, used_mem += block->size, num_blocks++;
+		last = block;
+		bprev = bsearch;
+		bsearch = bsearch->next;
+	}
+	if (num_blocks != arena->block_list->num_nodes)
+		return check_failed("wrong block count", 0);
+	// nothing left in the index past the last block
+	if (block_index_floor(arena, UINT64_MAX, NULL) != bprev)
+		return check_failed("stale block in the index", 0);
+	if (num_miniblocks != arena->num_miniblocks || used_mem != arena->used_mem)
+		return check_failed("wrong arena totals", 0);
+	return true;
+}
@@ -0,0 +1,435 @@
+/*
+	Command parsing and execution, apart from the I/O: the parser reads the
+	same syntax the console always had (fscanf tokens and numbers, lines for
+	PMAP and MPROTECT, raw bytes for WRITE) from chunks that can end anywhere
+*/
+#include <ctype.h>
+#include "vma.h"
+
+struct parser_t {
+	char *buf;
+	uint64_t len, cap, pos;
+	bool eof;
+	// last numbers read: a failed conversion keeps them, as fscanf did
+	uint64_t p1, p2;
+	/* size of the arena the next command runs on, as the commands parsed so
+	far left it; a WRITE payload can't be bigger */
+	uint64_t arena_size;
+};
+
+struct session_t {
+	arena_t arena;
+	bool arena_alloc;
+};
+
+// memory and number of the arenas of every session, for STATS
+static uint64_t arenas_used, arenas_live;
+
+// position in the parser data; starved is set when a read needs more input
+typedef struct cursor_t {
+	const parser_t *parser;
+	uint64_t i;
+	bool starved;
+} cursor_t;
+
+static const char *const cmd_names[] = {
+	[CMD_ALLOC_ARENA] = "ALLOC_ARENA", [CMD_DEALLOC_ARENA] = "DEALLOC_ARENA",
+	[CMD_ALLOC_BLOCK] = "ALLOC_BLOCK", [CMD_FREE_BLOCK] = "FREE_BLOCK",
+	[CMD_FREE_RANGE] = "FREE_RANGE", [CMD_REALLOC] = "REALLOC",
+	[CMD_READ] = "READ", [CMD_WRITE] = "WRITE", [CMD_PMAP] = "PMAP",
+	[CMD_BEGIN] = "BEGIN", [CMD_COMMIT] = "COMMIT", [CMD_ABORT] = "ABORT",
+	[CMD_STATS] = "STATS", [CMD_MEMSTAT] = "MEMSTAT",
+	[CMD_MPROTECT] = "MPROTECT"
+};
+
+// interprets the string and transform it to the corresponding numerical mask
+static uint8_t permission_convert(char *s)
+{
+	char *tmp;
+	tmp = strtok(s, " |\n");
+	bool r = false, w = false, x = false;
+	while (tmp) {
+		if (strcmp(tmp, "PROT_NONE") == 0)
+			r = false, w = false, x = false;
+		if (strcmp(tmp, "PROT_READ") == 0)
+			r = true;
+		if (strcmp(tmp, "PROT_WRITE") == 0)
+			w = true;
+		if (strcmp(tmp, "PROT_EXEC") == 0)
+			x = true;
+		tmp = strtok(NULL, " |\n");
+	}
+	int8_t conv = 0;
+	//boolean variables kept track of the permissions, no collisions when adding
+	if (x)
+		conv += 1;
+	if (w)
+		conv += 2;
+	if (r)
+		conv += 4;
+	return conv;
+}
+
+/* decimal numbers of the line, or hex after 0x (the Next cursor of pmap),
+at most max; -1 when the line holds anything else */
+static int parse_args(const char *s, uint64_t *args, int max)
+{
+	int n = 0;
+	char *end;
+	while (true) {
+		while (*s == ' ' || *s == '\t' || *s == '\r')
+			s++;
+		if (!*s)
+			return n;
+		if (n == max || *s < '0' || *s > '9')
+			return -1;
+		if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+			if (!isxdigit((unsigned char)s[2]))
+				return -1;
+			args[n++] = strtoull(s + 2, &end, 16);
+		} else {
+			args[n++] = strtoull(s, &end, 10);
+		}
+		// a number ends at a blank or at the end of the line
+		if (*end && *end != ' ' && *end != '\t' && *end != '\r')
+			return -1;
+		s = end;
+	}
+}
+
+// next byte, -1 at the end of the data
+static int peek(cursor_t *cur)
+{
+	if (cur->i < cur->parser->len)
+		return (unsigned char)cur->parser->buf[cur->i];
+	if (!cur->parser->eof)
+		cur->starved = true;
+	return -1;
+}
+
+static void skip_space(cursor_t *cur)
+{
+	int c = peek(cur);
+	while (c != -1 && isspace(c)) {
+		cur->i++;
+		c = peek(cur);
+	}
+}
+
+// the %49s conversion: a word of at most MAX_COMMAND - 1 characters
+static uint64_t read_token(cursor_t *cur, char *s)
+{
+	uint64_t len = 0;
+	int c;
+	skip_space(cur);
+	while (len + 1 < MAX_COMMAND && (c = peek(cur)) != -1 && !isspace(c)) {
+		s[len++] = (char)c;
+		cur->i++;
+	}
+	s[len] = '\0';
+	return len;
+}
+
+// the %lu conversion: false, with x unchanged, when no digit follows
+static bool read_num(cursor_t *cur, uint64_t *x)
+{
+	uint64_t value = 0;
+	bool neg = false, digits = false, overflow = false;
+	skip_space(cur);
+	int c = peek(cur);
+	if (c == '+' || c == '-') {
+		neg = c == '-';
+		cur->i++;
+		c = peek(cur);
+	}
+	while (c >= '0' && c <= '9') {
+		uint64_t d = (uint64_t)(c - '0');
+		if (value > (UINT64_MAX - d) / 10)
+			overflow = true;
+		value = value * 10 + d;
+		digits = true;
+		cur->i++;
+		c = peek(cur);
+	}
+	if (!digits)
+		return false;
+	if (overflow)
+		*x = UINT64_MAX;
+	else
+		*x = neg ? -value : value;
+	return true;
+}
+
+// reads the rest of the line, keeping at most cap - 1 characters of it
+static void read_line(cursor_t *cur, char *s, uint64_t cap)
+{
+	uint64_t len = 0;
+	int c = peek(cur);
+	while (c != -1 && c != '\n') {
+		if (len + 1 < cap)
+			s[len++] = (char)c;
+		cur->i++;
+		c = peek(cur);
+	}
+	if (c == '\n')
+		cur->i++;
+	s[len] = '\0';
+}
+
+parser_t *parser_create(void)
+{
+	parser_t *parser = calloc(1, sizeof(*parser));
+	if (!parser) {
+		fprintf(stderr, "Malloc failed!\n");
+		exit(1);
+	}
+	return parser;
+}
+
+// the consumed bytes are dropped before the buffer grows
+void parser_feed(parser_t *parser, const char *data, uint64_t len)
+{
+	if (parser->pos) {
+		memmove(parser->buf, parser->buf + parser->pos,
+				parser->len - parser->pos);
+		parser->len -= parser->pos;
+		parser->pos = 0;
+	}
+	if (parser->len + len > parser->cap) {
+		uint64_t cap = parser->cap ? parser->cap : IO_BUF_SIZE;
+		while (cap < parser->len + len)
+			cap *= 2;
+		parser->buf = realloc(parser->buf, cap);
+		if (!parser->buf) {
+			fprintf(stderr, "Malloc failed!\n");
+			exit(1);
+		}
+		parser->cap = cap;
+	}
+	memcpy(parser->buf + parser->len, data, len);
+	parser->len += len;
+}
+
+void parser_eof(parser_t *parser)
+{
+	parser->eof = true;
+}
+
+/* A command is taken only when it is whole, so a chunk can end anywhere;
+until then nothing is consumed. */
+int parse_next(parser_t *parser, command_t *cmd)
+{
+	cursor_t cur = {parser, parser->pos, false};
+	char token[MAX_COMMAND], line[MAX_COMMAND];
+	uint64_t p1 = parser->p1, p2 = parser->p2, size = 0;
+	int type = CMD_INVALID;
+
+	cmd->text = NULL, cmd->nargs = 0, cmd->perm = 0;
+	if (!read_token(&cur, token)) {
+		if (cur.starved)
+			return 0;
+		cmd->type = CMD_END;
+		return 1;
+	}
+	for (int i = CMD_ALLOC_ARENA; i <= CMD_MPROTECT; i++)
+		if (strcmp(token, cmd_names[i]) == 0)
+			type = i;
+	switch (type) {
+	case CMD_ALLOC_ARENA:
+	case CMD_FREE_BLOCK:
+		read_num(&cur, &p1);
+		break;
+	case CMD_ALLOC_BLOCK:
+	case CMD_FREE_RANGE:
+	case CMD_REALLOC:
+	case CMD_READ:
+		if (read_num(&cur, &p1))
+			read_num(&cur, &p2);
+		break;
+	case CMD_WRITE:
+		if (read_num(&cur, &p1))
+			read_num(&cur, &p2);
+		if (p2 > parser->arena_size) {
+			// invalid size: nothing is kept, the rest of the line is dropped
+			read_line(&cur, line, MAX_COMMAND);
+			cmd->nargs = -1;
+			break;
+		}
+		// the separator, then the data
+		if (peek(&cur) != -1)
+			cur.i++;
+		size = parser->len - cur.i;
+		if (size < p2 && !parser->eof)
+			cur.starved = true;
+		if (size > p2)
+			size = p2;
+		break;
+	case CMD_PMAP:
+		// optional window and page size: PMAP [start end [limit]]
+		read_line(&cur, line, MAX_COMMAND);
+		cmd->args[0] = 0, cmd->args[1] = 0, cmd->args[2] = 0;
+		cmd->nargs = parse_args(line, cmd->args, 3);
+		break;
+	case CMD_MPROTECT:
+		read_num(&cur, &p1);
+		read_line(&cur, line, MAX_COMMAND);
+		cmd->perm = permission_convert(line);
+		break;
+	}
+	if (cur.starved)
+		return 0;
+	if (type == CMD_WRITE && cmd->nargs != -1) {
+		// the input ended early: only the bytes received are written
+		cmd->text = malloc(size ? size : 1);
+		if (!cmd->text) {
+			fprintf(stderr, "Malloc failed!\n");
+			exit(1);
+		}
+		memcpy(cmd->text, parser->buf + cur.i, size);
+		cur.i += size;
+		p2 = size;
+	}
+	if (type == CMD_ALLOC_ARENA)
+		parser->arena_size = p1;
+	if (type == CMD_DEALLOC_ARENA)
+		parser->arena_size = 0;
+	cmd->type = (uint8_t)type;
+	if (type != CMD_PMAP)
+		cmd->args[0] = p1, cmd->args[1] = p2;
+	parser->pos = cur.i;
+	parser->p1 = p1, parser->p2 = p2;
+	return 1;
+}
+
+void parser_free(parser_t *parser)
+{
+	free(parser->buf);
+	free(parser);
+}
+
+session_t *session_create(void)
+{
+	session_t *session = calloc(1, sizeof(*session));
+	if (!session) {
+		fprintf(stderr, "Malloc failed!\n");
+		exit(1);
+	}
+	return session;
+}
+
+// connection between the command and the functions from vma.h
+static bool session_exec(session_t *session, command_t *cmd)
+{
+	arena_t *arena = &session->arena;
+	uint64_t p1 = cmd->args[0], p2 = cmd->args[1];
+
+	switch (cmd->type) {
+	case CMD_END:
+		if (session->arena_alloc)
+			dealloc_arena(arena);
+		session->arena_alloc = false;
+		return false;
+	case CMD_INVALID:
+		out_str("Invalid command. Please try again.\n");
+		return true;
+	case CMD_ALLOC_ARENA:
+		session->arena_alloc = alloc_arena(p1, arena);
+		if (!session->arena_alloc)
+			out_str("Not enough memory for the arena.\n");
+		return true;
+	case CMD_STATS:
+		pool_stats(arenas_used, arenas_live);
+		return true;
+	}
+	// the other commands need an arena
+	if (!session->arena_alloc)
+		return false;
+	switch (cmd->type) {
+	case CMD_DEALLOC_ARENA:
+		dealloc_arena(arena);
+		session->arena_alloc = false;
+		return false;
+	case CMD_ALLOC_BLOCK:
+		tx_alloc_block(arena, p1, p2);
+		break;
+	case CMD_FREE_BLOCK:
+		tx_free_block(arena, p1);
+		break;
+	case CMD_FREE_RANGE:
+		// not undoable, so not allowed in a transaction
+		if (arena->in_tx)
+			out_str("Operation not allowed in a transaction.\n");
+		else
+			free_range(arena, p1, p2);
+		break;
+	case CMD_REALLOC:
+		if (arena->in_tx)
+			out_str("Operation not allowed in a transaction.\n");
+		else
+			realloc_block(arena, p1, p2);
+		break;
+	case CMD_READ:
+		read(arena, p1, p2);
+		break;
+	case CMD_WRITE:
+		if (cmd->nargs == -1)
+			out_str("Invalid size for write.\n");
+		else
+			tx_write(arena, p1, p2, cmd->text);
+		break;
+	case CMD_PMAP:
+		if (cmd->nargs == 0)
+			pmap(arena);
+		else if (cmd->nargs >= 2)
+			pmap_range(arena, cmd->args[0], cmd->args[1], cmd->args[2]);
+		else
+			out_str("Invalid arguments for pmap.\n");
+		break;
+	case CMD_BEGIN:
+		tx_begin(arena);
+		break;
+	case CMD_COMMIT:
+		tx_commit(arena);
+		break;
+	case CMD_ABORT:
+		tx_abort(arena);
+		break;
+	case CMD_MEMSTAT:
+		memstat(arena);
+		break;
+	case CMD_MPROTECT:
+		//passing the address of perm
+		tx_mprotect(arena, p1, &cmd->perm);
+		break;
+	}
+	return true;
+}
+
+bool session_run(session_t *session, command_t *cmd)
+{
+	bool had_arena = session->arena_alloc;
+	uint64_t used = had_arena ? session->arena.used_mem : 0;
+	bool more = session_exec(session, cmd);
+	// the totals follow what the command changed
+	arenas_live += session->arena_alloc - had_arena;
+	arenas_used += (session->arena_alloc ? session->arena.used_mem : 0) - used;
+	free(cmd->text);
+	cmd->text = NULL;
+#ifdef VMA_DEBUG
+	if (session->arena_alloc && !check_arena(&session->arena)) {
+		out_drain();
+		abort();
+	}
+#endif
+	return more;
+}
+
+// the arena of a client gone before DEALLOC_ARENA is released here
+void session_free(session_t *session)
+{
+	if (session->arena_alloc) {
+		arenas_live--, arenas_used -= session->arena.used_mem;
+		dealloc_arena(&session->arena);
+	}
+	free(session);
+}
@@ -0,0 +1,83 @@
+/*
+	Commands as plain data: the incremental parser turns byte chunks into
+	commands and a session runs them on its own arena. Kept apart from
+	vma.h, so the I/O front end can use the system headers.
+*/
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#pragma once
+#include <inttypes.h>
+#include <stdbool.h>
+
+// size of an input chunk and of an output buffer
+#define IO_BUF_SIZE (1 << 20)
+#define OUT_BUF_SIZE (1 << 20)
+
+// kinds of commands
+#define CMD_END 0
+#define CMD_INVALID 1
+#define CMD_ALLOC_ARENA 2
+#define CMD_DEALLOC_ARENA 3
+#define CMD_ALLOC_BLOCK 4
+#define CMD_FREE_BLOCK 5
+#define CMD_FREE_RANGE 6
+#define CMD_REALLOC 7
+#define CMD_READ 8
+#define CMD_WRITE 9
+#define CMD_PMAP 10
+#define CMD_BEGIN 11
+#define CMD_COMMIT 12
+#define CMD_ABORT 13
+#define CMD_STATS 14
+#define CMD_MEMSTAT 15
+#define CMD_MPROTECT 16
+
+typedef struct command_t {
+	uint8_t type;
+	// permission mask of MPROTECT
+	uint8_t perm;
+	// number of PMAP arguments, -1 when they are malformed or when the
+	// WRITE size is past the arena (then text is NULL)
+	int nargs;
+	uint64_t args[3];
+	// WRITE payload, args[1] bytes, owned by the command
+	char *text;
+} command_t;
+
+typedef struct parser_t parser_t;
+typedef struct session_t session_t;
+
+// incremental parser: parse_next gives 1 for a command, 0 when it needs more
+// input; after parser_eof the input ends with a CMD_END command
+parser_t *parser_create(void);
+void parser_feed(parser_t *parser, const char *data, uint64_t len);
+void parser_eof(parser_t *parser);
+int parse_next(parser_t *parser, command_t *cmd);
+void parser_free(parser_t *parser);
+
+// a client of the allocator, with its arena; session_run releases the
+// command and gives false when the session is over
+session_t *session_create(void);
+bool session_run(session_t *session, command_t *cmd);
+void session_free(session_t *session);
+
+/* The sessions of a process share its heap and its buffer pool: the socket
+server has every rw_buffer zeroed (POOL_ZERO from then on), so a session
+never reads the bytes another one left */
+void pool_zero_buffers(void);
+
+/* Where out_flush sends the output: flush takes the filled buffer and gives
+back the one to fill next, drain waits until everything is written. NULL
+in out_set_sink is stdout, written right away. */
+typedef struct out_sink_t {
+	char *(*flush)(void *ctx, char *buf, uint64_t len);
+	void (*drain)(void *ctx);
+	void *ctx;
+} out_sink_t;
+
+void out_set_sink(const out_sink_t *sink);
+void out_flush(void);
+void out_drain(void);
+
+#endif
@@ -0,0 +1,607 @@
+/*
+	I/O front end. The console runs on three threads: the reader takes the
+	input in big chunks (io_uring, with the next read already submitted
+	while a chunk is parsed) and queues the parsed commands, the command
+	loop runs them, the writer sends the filled output buffers. The socket
+	server is a single epoll loop, with a parser and a session per client.
+
+	The program defines read and write of its own, so the system ones are
+	never called here: readv, writev, recv and send do the work.
+*/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include "frontend.h"
+
+// submission and completion rings of an io_uring instance
+typedef struct uring_t {
+	int fd;
+	unsigned *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+} uring_t;
+
+// input of the console: io_uring, or epoll and readv
+typedef struct source_t {
+	int fd;
+	bool uring;
+	uring_t ring;
+	// epoll instance, -1 when fd can't be polled (a regular file)
+	int epfd;
+	// the chunk being parsed and the one being read
+	char *chunk[2];
+	int cur;
+	bool started;
+} source_t;
+
+typedef struct cmd_queue_t {
+	command_t items[CMD_QUEUE];
+	uint64_t head, tail;
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty, not_full;
+} cmd_queue_t;
+
+typedef struct out_item_t {
+	char *buf;
+	uint64_t len;
+} out_item_t;
+
+// writer thread: filled buffers in queue, empty ones in spare
+typedef struct writer_t {
+	int fd;
+	out_item_t queue[OUT_BUFFERS];
+	uint64_t head, tail;
+	char *spare[OUT_BUFFERS];
+	int num_spare;
+	bool busy, stop;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+} writer_t;
+
+typedef struct client_t {
+	int fd;
+	parser_t *parser;
+	session_t *session;
+	out_sink_t sink;
+	// output not sent yet: bytes out_sent .. out_len of out
+	char *out;
+	uint64_t out_len, out_cap, out_sent;
+	// eof: no more input; done: session over, closed once out is sent
+	bool eof, done;
+} client_t;
+
+static char read_chunks[2][IO_BUF_SIZE];
+// the command loop fills one more buffer, the output engine's own
+static char write_bufs[OUT_BUFFERS - 1][OUT_BUF_SIZE];
+static source_t source;
+static parser_t *console_parser;
+static cmd_queue_t cmd_queue = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.not_empty = PTHREAD_COND_INITIALIZER,
+	.not_full = PTHREAD_COND_INITIALIZER
+};
+static writer_t writer = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER
+};
+
+static bool uring_init(uring_t *ring)
+{
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	ring->fd = (int)syscall(__NR_io_uring_setup, 4, &params);
+	if (ring->fd < 0)
+		return false;
+	// the reads use the file position (offset -1) and one ring mapping
+	if (!(params.features & IORING_FEAT_RW_CUR_POS) ||
+		!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+		close(ring->fd);
+		return false;
+	}
+	size_t sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	size_t cq_len = params.cq_off.cqes +
+					params.cq_entries * sizeof(struct io_uring_cqe);
+	size_t len = sq_len > cq_len ? sq_len : cq_len;
+	char *rings = mmap(NULL, len, PROT_READ | PROT_WRITE,
+					   MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (rings == MAP_FAILED) {
+		close(ring->fd);
+		return false;
+	}
+	ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+					  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+					  ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		munmap(rings, len);
+		close(ring->fd);
+		return false;
+	}
+	ring->sq_tail = (unsigned *)(rings + params.sq_off.tail);
+	ring->sq_mask = (unsigned *)(rings + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)(rings + params.sq_off.array);
+	ring->cq_head = (unsigned *)(rings + params.cq_off.head);
+	ring->cq_tail = (unsigned *)(rings + params.cq_off.tail);
+	ring->cq_mask = (unsigned *)(rings + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(rings + params.cq_off.cqes);
+	return true;
+}
+
+// queues a read of len bytes at the file position; false if it can't
+static bool uring_read(uring_t *ring, int fd, char *buf, unsigned len)
+{
+	unsigned tail = *ring->sq_tail, idx = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)buf;
+	sqe->len = len;
+	sqe->off = (uint64_t)-1;
+	ring->sq_array[idx] = idx;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	while (syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, NULL, 0) < 0)
+		if (errno != EINTR)
+			return false;
+	return true;
+}
+
+// result of the read in flight: bytes read or -errno
+static int uring_wait(uring_t *ring)
+{
+	unsigned head = *ring->cq_head;
+	while (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+		if (syscall(__NR_io_uring_enter, ring->fd, 0, 1,
+					IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+			return -errno;
+	}
+	int res = ring->cqes[head & *ring->cq_mask].res;
+	__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+	return res;
+}
+
+static void source_init(source_t *src, int fd, bool use_uring)
+{
+	struct epoll_event ev = {.events = EPOLLIN};
+	src->fd = fd;
+	src->chunk[0] = read_chunks[0], src->chunk[1] = read_chunks[1];
+	src->uring = use_uring && uring_init(&src->ring);
+	src->epfd = epoll_create1(0);
+	if (src->epfd >= 0 && epoll_ctl(src->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		close(src->epfd);
+		src->epfd = -1;
+	}
+}
+
+// epoll fallback: waits for input, then takes what there is
+static int64_t source_readv(source_t *src, char *buf)
+{
+	struct iovec iov = {buf, IO_BUF_SIZE};
+	struct epoll_event ev;
+	while (true) {
+		if (src->epfd >= 0 && epoll_wait(src->epfd, &ev, 1, -1) < 0 &&
+			errno != EINTR)
+			return 0;
+		ssize_t n = readv(src->fd, &iov, 1);
+		if (n >= 0)
+			return n;
+		if (errno != EINTR && errno != EAGAIN)
+			return 0;
+	}
+}
+
+/* Next chunk of input in *data, 0 at the end. With io_uring the read of
+the next chunk is submitted before this one is returned, so the kernel
+fills it while this one is parsed. */
+static int64_t source_next(source_t *src, char **data)
+{
+	if (src->uring && !src->started) {
+		src->started = true;
+		if (!uring_read(&src->ring, src->fd, src->chunk[0], IO_BUF_SIZE))
+			src->uring = false;
+	}
+	if (!src->uring) {
+		*data = src->chunk[0];
+		return source_readv(src, src->chunk[0]);
+	}
+	int res = uring_wait(&src->ring);
+	while (res == -EINTR || res == -EAGAIN) {
+		if (!uring_read(&src->ring, src->fd, src->chunk[src->cur],
+						IO_BUF_SIZE))
+			return 0;
+		res = uring_wait(&src->ring);
+	}
+	if (res == -EINVAL || res == -EOPNOTSUPP) {
+		// a kernel without IORING_OP_READ, nothing was read yet
+		src->uring = false;
+		*data = src->chunk[0];
+		return source_readv(src, src->chunk[0]);
+	}
+	if (res <= 0)
+		return 0;
+	*data = src->chunk[src->cur];
+	src->cur ^= 1;
+	if (!uring_read(&src->ring, src->fd, src->chunk[src->cur], IO_BUF_SIZE))
+		src->uring = false;
+	return res;
+}
+
+static void queue_push(cmd_queue_t *queue, const command_t *cmds, int n)
+{
+	pthread_mutex_lock(&queue->lock);
+	for (int i = 0; i < n; i++) {
+		while (queue->tail - queue->head == CMD_QUEUE) {
+			pthread_cond_signal(&queue->not_empty);
+			pthread_cond_wait(&queue->not_full, &queue->lock);
+		}
+		queue->items[queue->tail++ % CMD_QUEUE] = cmds[i];
+	}
+	pthread_cond_signal(&queue->not_empty);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+// at most max commands; with wait false, 0 when there is none yet
+static int queue_pop(cmd_queue_t *queue, command_t *cmds, int max, bool wait)
+{
+	int n = 0;
+	pthread_mutex_lock(&queue->lock);
+	while (wait && queue->head == queue->tail)
+		pthread_cond_wait(&queue->not_empty, &queue->lock);
+	while (n < max && queue->head != queue->tail)
+		cmds[n++] = queue->items[queue->head++ % CMD_QUEUE];
+	if (n)
+		pthread_cond_signal(&queue->not_full);
+	pthread_mutex_unlock(&queue->lock);
+	return n;
+}
+
+// parses every chunk as soon as it is read, until the end of the input
+static void *reader_loop(void *arg)
+{
+	command_t batch[CMD_BATCH];
+	bool end = false;
+	(void)arg;
+	while (!end) {
+		char *data;
+		int64_t len = source_next(&source, &data);
+		if (len)
+			parser_feed(console_parser, data, (uint64_t)len);
+		else
+			parser_eof(console_parser);
+		int n = 0;
+		while (!end && parse_next(console_parser, &batch[n])) {
+			end = batch[n].type == CMD_END;
+			if (++n == CMD_BATCH) {
+				queue_push(&cmd_queue, batch, n);
+				n = 0;
+			}
+		}
+		if (n)
+			queue_push(&cmd_queue, batch, n);
+	}
+	return NULL;
+}
+
+// writes everything, unless the descriptor fails
+static void writev_all(int fd, struct iovec *iov, int n)
+{
+	while (n) {
+		ssize_t len = writev(fd, iov, n);
+		if (len < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return;
+		}
+		while (n && (size_t)len >= iov->iov_len) {
+			len -= (ssize_t)iov->iov_len;
+			iov++, n--;
+		}
+		if (n) {
+			iov->iov_base = (char *)iov->iov_base + len;
+			iov->iov_len -= (size_t)len;
+		}
+	}
+}
+
+// the buffers waiting at the same time leave in one writev
+static void *writer_loop(void *arg)
+{
+	writer_t *w = arg;
+	struct iovec iov[OUT_BUFFERS];
+	pthread_mutex_lock(&w->lock);
+	while (true) {
+		while (w->head == w->tail && !w->stop)
+			pthread_cond_wait(&w->cond, &w->lock);
+		if (w->head == w->tail)
+			break;
+		int n = (int)(w->tail - w->head);
+		for (int i = 0; i < n; i++) {
+			out_item_t *item = &w->queue[(w->head + i) % OUT_BUFFERS];
+			iov[i].iov_base = item->buf, iov[i].iov_len = item->len;
+		}
+		w->busy = true;
+		pthread_mutex_unlock(&w->lock);
+		writev_all(w->fd, iov, n);
+		pthread_mutex_lock(&w->lock);
+		for (int i = 0; i < n; i++)
+			w->spare[w->num_spare++] = w->queue[w->head++ % OUT_BUFFERS].buf;
+		w->busy = false;
+		pthread_cond_broadcast(&w->cond);
+	}
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+// out_sink_t flush: the buffer goes to the writer, a spare one comes back
+static char *writer_flush(void *ctx, char *buf, uint64_t len)
+{
+	writer_t *w = ctx;
+	pthread_mutex_lock(&w->lock);
+	w->queue[w->tail++ % OUT_BUFFERS] = (out_item_t){buf, len};
+	pthread_cond_broadcast(&w->cond);
+	while (!w->num_spare)
+		pthread_cond_wait(&w->cond, &w->lock);
+	buf = w->spare[--w->num_spare];
+	pthread_mutex_unlock(&w->lock);
+	return buf;
+}
+
+static void writer_drain(void *ctx)
+{
+	writer_t *w = ctx;
+	pthread_mutex_lock(&w->lock);
+	while (w->head != w->tail || w->busy)
+		pthread_cond_wait(&w->cond, &w->lock);
+	pthread_mutex_unlock(&w->lock);
+}
+
+// false when the thread can't start: the output then stays synchronous
+static bool writer_start(writer_t *w, int fd)
+{
+	w->fd = fd;
+	for (int i = 0; i < OUT_BUFFERS - 1; i++)
+		w->spare[w->num_spare++] = write_bufs[i];
+	return pthread_create(&w->thread, NULL, writer_loop, w) == 0;
+}
+
+static void writer_stop(writer_t *w)
+{
+	pthread_mutex_lock(&w->lock);
+	w->stop = true;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+	pthread_join(w->thread, NULL);
+}
+
+/* The output is flushed whenever the queue is empty, so the answer is
+visible before the next command is awaited, but a batch of queued
+commands shares its buffers. */
+void frontend_console(bool use_uring)
+{
+	static const out_sink_t writer_sink = {writer_flush, writer_drain, &writer};
+	command_t batch[CMD_BATCH];
+	pthread_t reader;
+	session_t *session = session_create();
+	bool more = true, async = writer_start(&writer, STDOUT_FILENO);
+
+	console_parser = parser_create();
+	source_init(&source, STDIN_FILENO, use_uring);
+	if (async)
+		out_set_sink(&writer_sink);
+	if (pthread_create(&reader, NULL, reader_loop, NULL)) {
+		fprintf(stderr, "Thread creation failed!\n");
+		exit(1);
+	}
+	while (more) {
+		int n = queue_pop(&cmd_queue, batch, CMD_BATCH, false);
+		if (!n) {
+			out_flush();
+			n = queue_pop(&cmd_queue, batch, CMD_BATCH, true);
+		}
+		for (int i = 0; i < n; i++) {
+			if (more)
+				more = session_run(session, &batch[i]);
+			else
+				free(batch[i].text);
+		}
+	}
+	out_drain();
+	if (async) {
+		out_set_sink(NULL);
+		writer_stop(&writer);
+	}
+	session_free(session);
+	// the reader may still wait for input: it ends with the process
+	pthread_detach(reader);
+}
+
+// out_sink_t flush of a client: the output waits in its own buffer
+static char *client_flush(void *ctx, char *buf, uint64_t len)
+{
+	client_t *client = ctx;
+	if (client->out_len + len > client->out_cap) {
+		uint64_t cap = client->out_cap ? client->out_cap : OUT_BUF_SIZE;
+		while (cap < client->out_len + len)
+			cap *= 2;
+		client->out = realloc(client->out, cap);
+		if (!client->out) {
+			fprintf(stderr, "Malloc failed!\n");
+			exit(1);
+		}
+		client->out_cap = cap;
+	}
+	memcpy(client->out + client->out_len, buf, len);
+	client->out_len += len;
+	return buf;
+}
+
+static client_t *client_create(int fd)
+{
+	client_t *client = calloc(1, sizeof(*client));
+	if (!client) {
+		fprintf(stderr, "Malloc failed!\n");
+		exit(1);
+	}
+	client->fd = fd;
+	client->parser = parser_create();
+	client->session = session_create();
+	client->sink = (out_sink_t){client_flush, NULL, client};
+	return client;
+}
+
+static void client_close(int epfd, client_t *client)
+{
+	epoll_ctl(epfd, EPOLL_CTL_DEL, client->fd, NULL);
+	close(client->fd);
+	session_free(client->session);
+	parser_free(client->parser);
+	free(client->out);
+	free(client);
+}
+
+// false when the client is gone
+static bool client_recv(client_t *client, char *chunk)
+{
+	while (!client->eof) {
+		ssize_t n = recv(client->fd, chunk, IO_BUF_SIZE, 0);
+		if (n > 0) {
+			parser_feed(client->parser, chunk, (uint64_t)n);
+		} else if (n == 0) {
+			client->eof = true;
+			parser_eof(client->parser);
+		} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return true;
+		} else if (errno != EINTR) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// false when the client is gone
+static bool client_send(client_t *client)
+{
+	while (client->out_sent < client->out_len) {
+		ssize_t n = send(client->fd, client->out + client->out_sent,
+						 client->out_len - client->out_sent,
+						 MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n >= 0)
+			client->out_sent += (uint64_t)n;
+		else if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return true;
+		else if (errno != EINTR)
+			return false;
+	}
+	client->out_len = 0, client->out_sent = 0;
+	return true;
+}
+
+/* Runs at most CMD_BATCH parsed commands while the unsent output is small,
+sends it, then waits for input, for room in the socket or for nothing
+(closed). A client with commands left asks for EPOLLOUT, so it is back at
+the next epoll_wait, after the clients already waiting. */
+static void client_pump(int epfd, client_t *client)
+{
+	command_t cmd;
+	int batch = 0;
+	out_set_sink(&client->sink);
+	while (!client->done && batch < CMD_BATCH &&
+		   client->out_len < CLIENT_BACKLOG &&
+		   parse_next(client->parser, &cmd)) {
+		if (!session_run(client->session, &cmd))
+			client->done = true;
+		batch++;
+	}
+	out_set_sink(NULL);
+	if (!client_send(client)) {
+		client_close(epfd, client);
+		return;
+	}
+	bool pending = client->out_sent < client->out_len;
+	if (client->done && !pending) {
+		client_close(epfd, client);
+		return;
+	}
+	struct epoll_event ev = {.events = 0, .data.ptr = client};
+	if (pending || (batch == CMD_BATCH && !client->done))
+		ev.events |= EPOLLOUT;
+	if (!client->done && !client->eof && client->out_len < CLIENT_BACKLOG)
+		ev.events |= EPOLLIN;
+	epoll_ctl(epfd, EPOLL_CTL_MOD, client->fd, &ev);
+}
+
+static void server_accept(int epfd, int lfd)
+{
+	while (true) {
+		int fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		client_t *client = client_create(fd);
+		struct epoll_event ev = {.events = EPOLLIN, .data.ptr = client};
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+			client_close(epfd, client);
+	}
+}
+
+int frontend_listen(const char *path)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+	struct epoll_event events[CMD_BATCH];
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path too long\n");
+		return 1;
+	}
+	strcpy(addr.sun_path, path);
+	int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	// a socket left by an old server is replaced
+	unlink(path);
+	if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+		listen(lfd, SOMAXCONN) < 0) {
+		perror("listen");
+		return 1;
+	}
+	int epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev) < 0) {
+		perror("epoll");
+		return 1;
+	}
+	// the clients share the heap and the pool
+	pool_zero_buffers();
+	while (true) {
+		int n = epoll_wait(epfd, events, CMD_BATCH, -1);
+		if (n < 0 && errno != EINTR) {
+			perror("epoll_wait");
+			return 1;
+		}
+		for (int i = 0; i < n; i++) {
+			client_t *client = events[i].data.ptr;
+			if (!client) {
+				server_accept(epfd, lfd);
+				continue;
+			}
+			if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) &&
+				!client_recv(client, read_chunks[0])) {
+				client_close(epfd, client);
+				continue;
+			}
+			client_pump(epfd, client);
+		}
+	}
+}
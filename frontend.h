@@ -0,0 +1,27 @@
+/*
+	I/O front end: the console, where a reader thread parses the input
+	(io_uring reads, epoll otherwise) while the commands run and a writer
+	thread sends the output, or a Unix socket server with one session for
+	every client. Kept apart from vma.h, which declares read and write.
+*/
+#ifndef FRONTEND_H
+#define FRONTEND_H
+
+#pragma once
+#include "command.h"
+
+// parsed commands waiting for the command loop, at most
+#define CMD_QUEUE 1024
+// commands moved through the queue at once
+#define CMD_BATCH 64
+// output buffers shared by the command loop and the writer thread
+#define OUT_BUFFERS 4
+// output kept for a client before its input is no longer read
+#define CLIENT_BACKLOG (4 << 20)
+
+// runs the commands of stdin; use_uring false goes straight to epoll
+void frontend_console(bool use_uring);
+// serves the clients of the socket at path; returns only on error
+int frontend_listen(const char *path);
+
+#endif
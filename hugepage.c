@@ -0,0 +1,182 @@
+/*
+	Huge page mappings: explicit MAP_HUGETLB pages first (they need pages
+	reserved by the system), otherwise a normal mapping with the
+	transparent huge page hint
+*/
+#define _DEFAULT_SOURCE
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "hugepage.h"
+
+// a live mapping: the buffer size asked for and how the mapping was made
+typedef struct huge_entry_t {
+	void *buf;
+	uint64_t size, len;
+	bool tlb;
+} huge_entry_t;
+
+// the live mappings, kept by the command loop only
+static huge_entry_t *huge_live;
+static uint64_t huge_num, huge_cap;
+/* the last MAP_HUGETLB failed: the reserved pages ran out, so the hint is
+used until a MAP_HUGETLB mapping gives its pages back */
+static bool hugetlb_failed;
+
+static void huge_track(void *buf, uint64_t size, uint64_t len, bool tlb)
+{
+	if (huge_num == huge_cap) {
+		huge_cap = huge_cap ? 2 * huge_cap : 16;
+		huge_live = realloc(huge_live, huge_cap * sizeof(huge_entry_t));
+		if (!huge_live) {
+			fprintf(stderr, "Malloc failed!\n");
+			exit(1);
+		}
+	}
+	huge_entry_t *entry = &huge_live[huge_num++];
+	entry->buf = buf, entry->size = size;
+	entry->len = len, entry->tlb = tlb;
+}
+
+static huge_entry_t *huge_find(const void *buf)
+{
+	for (uint64_t i = 0; i < huge_num; i++)
+		if (huge_live[i].buf == buf)
+			return &huge_live[i];
+	return NULL;
+}
+
+// mapped length of a buffer, a multiple of the huge page size
+uint64_t huge_length(uint64_t size)
+{
+	return (size + HUGE_PAGE_SIZE - 1) & ~((uint64_t)HUGE_PAGE_SIZE - 1);
+}
+
+void *huge_alloc(uint64_t size)
+{
+	uint64_t len = huge_length(size);
+	void *buf;
+	if (!hugetlb_failed) {
+		buf = mmap(NULL, len, PROT_READ | PROT_WRITE,
+				   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (buf != MAP_FAILED) {
+			huge_track(buf, size, len, true);
+			return buf;
+		}
+		// no reserved huge page left, the next calls go straight to the hint
+		hugetlb_failed = true;
+	}
+	buf = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buf == MAP_FAILED) {
+		fprintf(stderr, "Malloc failed!\n");
+		exit(1);
+	}
+	// only a hint: the pages actually backing it are read at huge_stats
+	madvise(buf, len, MADV_HUGEPAGE);
+	huge_track(buf, size, len, false);
+	return buf;
+}
+
+// the buffer was kept by a resize within the same mapped length
+void huge_resized(void *buf, uint64_t size)
+{
+	huge_entry_t *entry = huge_find(buf);
+	if (entry)
+		entry->size = size;
+}
+
+// called by the command loop before the buffer goes to huge_free
+void huge_forget(void *buf)
+{
+	huge_entry_t *entry = huge_find(buf);
+	if (!entry)
+		return;
+	// its reserved pages come back, MAP_HUGETLB is worth another try
+	if (entry->tlb)
+		hugetlb_failed = false;
+	*entry = huge_live[--huge_num];
+}
+
+// also called by the reclaimer thread, so it touches no statistics
+void huge_free(void *buf, uint64_t size)
+{
+	munmap(buf, huge_length(size));
+}
+
+static int entry_cmp(const void *a, const void *b)
+{
+	const huge_entry_t *x = *(huge_entry_t *const *)a;
+	const huge_entry_t *y = *(huge_entry_t *const *)b;
+	return x->buf < y->buf ? -1 : x->buf > y->buf;
+}
+
+// the entry of the sorted array starting at buf, NULL if none
+static huge_entry_t *entry_search(huge_entry_t **sorted, uint64_t n,
+								  uint64_t buf)
+{
+	uint64_t lo = 0, hi = n;
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		if ((uint64_t)sorted[mid]->buf == buf)
+			return sorted[mid];
+		if ((uint64_t)sorted[mid]->buf < buf)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return NULL;
+}
+
+/* AnonHugePages of the hinted buffers, each counted at most at its size:
+smaps is read once, every mapping start looked up among the buffers */
+static uint64_t huge_backed(huge_entry_t **sorted, uint64_t n)
+{
+	char line[256];
+	uint64_t start, end, kb, thp = 0;
+	huge_entry_t *entry = NULL;
+	FILE *smaps = fopen("/proc/self/smaps", "r");
+	if (!smaps)
+		return 0;
+	while (fgets(line, sizeof(line), smaps)) {
+		if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+			entry = entry_search(sorted, n, start);
+		} else if (entry && sscanf(line, "AnonHugePages: %lu", &kb) == 1) {
+			kb <<= 10;
+			thp += kb < entry->size ? kb : entry->size;
+			entry = NULL;
+		}
+	}
+	fclose(smaps);
+	return thp;
+}
+
+/* count and bytes of the live buffers; tlb and thp are the bytes of them
+really on huge pages, each buffer counted at most at its size */
+void huge_stats(uint64_t *count, uint64_t *total, uint64_t *tlb,
+				uint64_t *thp)
+{
+	huge_entry_t **sorted = malloc((huge_num ? huge_num : 1) *
+								   sizeof(huge_entry_t *));
+	uint64_t n = 0;
+	if (!sorted) {
+		fprintf(stderr, "Malloc failed!\n");
+		exit(1);
+	}
+	*count = huge_num, *total = 0, *tlb = 0, *thp = 0;
+	for (uint64_t i = 0; i < huge_num; i++) {
+		huge_entry_t *entry = &huge_live[i];
+		*total += entry->size;
+		if (entry->tlb)
+			*tlb += entry->size;
+		else
+			sorted[n++] = entry;
+	}
+	if (n) {
+		qsort(sorted, n, sizeof(huge_entry_t *), entry_cmp);
+		*thp = huge_backed(sorted, n);
+	}
+	free(sorted);
+}
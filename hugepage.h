@@ -0,0 +1,33 @@
+/*
+	Huge page backing for the large rw_buffers. Kept apart from vma.h,
+	because sys/mman.h declares an mprotect of its own.
+*/
+#ifndef HUGEPAGE_H
+#define HUGEPAGE_H
+
+#pragma once
+#include <inttypes.h>
+
+// engine variant: 0 keeps every rw_buffer on malloc
+#ifndef VMA_HUGEPAGES
+#define VMA_HUGEPAGES 1
+#endif
+
+// rw_buffers from this size up are mapped on huge pages
+#if !VMA_HUGEPAGES
+#undef HUGE_THRESHOLD
+#define HUGE_THRESHOLD UINT64_MAX
+#elif !defined(HUGE_THRESHOLD)
+#define HUGE_THRESHOLD (4 << 20)
+#endif
+#define HUGE_PAGE_SIZE (2 << 20)
+
+uint64_t huge_length(uint64_t size);
+void *huge_alloc(uint64_t size);
+void huge_resized(void *buf, uint64_t size);
+void huge_forget(void *buf);
+void huge_free(void *buf, uint64_t size);
+void huge_stats(uint64_t *count, uint64_t *total, uint64_t *tlb,
+				uint64_t *thp);
+
+#endif
@@ -97,3 +97,38 @@ node_t *remove_nth_node(list_t *dll, uint64_t n)
 
 	return act;
 }
+
+// adds a node right after prev without walking the list, returns it
+node_t *add_node_after(list_t *dll, node_t *prev, const void *new_info)
+{
+	node_t *new_node = malloc(sizeof(*new_node));
+	if (!new_node) {
+		fprintf(stderr, "Malloc failed!\n");
+		exit(1);
+	}
+	new_node->info = malloc(dll->info_size);
+	if (!new_node->info) {
+		fprintf(stderr, "Malloc failed!\n");
+		exit(1);
+	}
+	memcpy(new_node->info, new_info, dll->info_size);
+	new_node->prev = prev;
+	new_node->next = prev->next;
+	if (prev->next)
+		prev->next->prev = new_node;
+	prev->next = new_node;
+	dll->num_nodes++;
+	return new_node;
+}
+
+// unlinks the node from the list; freeing it is up to the caller
+void remove_node(list_t *dll, node_t *node)
+{
+	if (node->prev)
+		node->prev->next = node->next;
+	else
+		dll->head = node->next;
+	if (node->next)
+		node->next->prev = node->prev;
+	dll->num_nodes--;
+}
@@ -2,114 +2,28 @@
 	User interface program in C console
 */
 #include "vma.h"
+#include "frontend.h"
 
-// interprets the string and transform it to the corresponding numerical mask
-uint8_t permission_convert(char *s)
+int main(int argc, char *argv[])
 {
-	char *tmp;
-	tmp = strtok(s, " |\n");
-	bool r = false, w = false, x = false;
-	while (tmp) {
-		if (strcmp(tmp, "PROT_NONE") == 0)
-			r = false, w = false, x = false;
-		if (strcmp(tmp, "PROT_READ") == 0)
-			r = true;
-		if (strcmp(tmp, "PROT_WRITE") == 0)
-			w = true;
-		if (strcmp(tmp, "PROT_EXEC") == 0)
-			x = true;
-		tmp = strtok(NULL, " |\n");
-	}
-	int8_t conv = 0;
-	//boolean variables kept track of the permissions, no collisions when adding
-	if (x)
-		conv += 1;
-	if (w)
-		conv += 2;
-	if (r)
-		conv += 4;
-	return conv;
-}
-
-int main(void)
-{
-	char *command = malloc(MAX_COMMAND);
-	bool arena_alloc = false;
-	if (!command) {
-		fprintf(stderr, "Malloc failed!\n");
-		exit(1);
-	}
-	char *prot = malloc(MAX_COMMAND);
-	if (!prot) {
-		fprintf(stderr, "Malloc failed!\n");
-		exit(1);
-	}
-	char *text = malloc(MAX_TEXT);
-	if (!text) {
-		fprintf(stderr, "Malloc failed!\n");
-		exit(1);
-	}
-	uint64_t p1, p2;
-	arena_t arena;
-
-	// infinite loop for command session
-	while (true) {
-		fscanf(stdin, "%s", command);
-
-		// connection between the command and the functions from vma.h
-		if (strcmp(command, "ALLOC_ARENA") == 0) {
-			arena_alloc = true;
-			fscanf(stdin, "%lu", &p1);
-			alloc_arena(p1, &arena);
-		} else if (strcmp(command, "DEALLOC_ARENA") == 0) {
-			if (!arena_alloc)
-				break;
-			dealloc_arena(&arena);
-			break;
-		} else if (strcmp(command, "ALLOC_BLOCK") == 0) {
-			if (!arena_alloc)
-				break;
-			fscanf(stdin, "%lu%lu", &p1, &p2);
-			alloc_block(&arena, p1, p2);
-		} else if (strcmp(command, "FREE_BLOCK") == 0) {
-			if (!arena_alloc)
-				break;
-			fscanf(stdin, "%lu", &p1);
-			free_block(&arena, p1);
-		} else if (strcmp(command, "READ") == 0) {
-			if (!arena_alloc)
-				break;
-			fscanf(stdin, "%lu%lu", &p1, &p2);
-			read(&arena, p1, p2);
-		} else if (strcmp(command, "WRITE") == 0) {
-			if (!arena_alloc)
-				break;
-			fscanf(stdin, "%lu%lu", &p1, &p2);
-			fgetc(stdin);
-			uint64_t i = 0;
-			while (i < p2) {
-				text[i] = fgetc(stdin);
-				i++;
-			}
-			write(&arena, p1, p2, text);
-		} else if (strcmp(command, "PMAP") == 0) {
-			if (!arena_alloc)
-				break;
-			pmap(&arena);
-		} else if (strcmp(command, "MPROTECT") == 0) {
-			if (!arena_alloc)
-				break;
-			fscanf(stdin, "%lu", &p1);
-			fgets(prot, MAX_COMMAND, stdin);
-			uint8_t perm = permission_convert(prot);
-			//passing the address of perm
-			mprotect(&arena, p1, &perm);
+	bool use_uring = true;
+	const char *path = NULL;
+	// the output is buffered by output.c: one write for every flush
+	setvbuf(stdout, NULL, _IONBF, 0);
+	atexit(out_drain);
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--epoll") == 0) {
+			use_uring = false;
+		} else if (strcmp(argv[i], "--listen") == 0 && i + 1 < argc) {
+			path = argv[++i];
 		} else {
-			fprintf(stdout, "Invalid command. Please try again.\n");
+			fprintf(stderr, "Usage: %s [--epoll] [--listen PATH]\n", argv[0]);
+			return 1;
 		}
 	}
-	free(command);
-	free(prot);
-	free(text);
+	// a server for the clients of a Unix socket, or the console
+	if (path)
+		return frontend_listen(path);
+	frontend_console(use_uring);
 	return 0;
 }
@@ -0,0 +1,85 @@
+/*
+	MEMSTAT: memory taken by the arena representation, payload against
+	metadata, compared with a packed layout (arrays of records, no nodes)
+*/
+#include "vma.h"
+
+// records of the packed layout: start, size, perm, buffer for a miniblock;
+// start, size, first miniblock, count for a block
+#define PACKED_MINIBLOCK_SIZE 25
+#define PACKED_BLOCK_SIZE 32
+
+// glibc chunk taken by malloc(n): 8 bytes header, 16 bytes alignment
+uint64_t malloc_footprint(uint64_t n)
+{
+	uint64_t chunk = (n + 8 + 15) & ~(uint64_t)15;
+	return chunk < 32 ? 32 : chunk;
+}
+
+// VmHWM line of /proc/self/status, in kB; 0 when it can't be read
+static uint64_t peak_resident(void)
+{
+	char line[128];
+	uint64_t kb = 0;
+	FILE *f = fopen("/proc/self/status", "r");
+	if (!f)
+		return 0;
+	while (fgets(line, sizeof(line), f)) {
+		if (strncmp(line, "VmHWM:", 6) == 0) {
+			sscanf(line + 6, "%lu", &kb);
+			break;
+		}
+	}
+	fclose(f);
+	return kb;
+}
+
+void memstat(const arena_t *arena)
+{
+	uint64_t num_blocks = arena->block_list->num_nodes;
+	uint64_t num_miniblocks = arena->num_miniblocks;
+	uint64_t index_used, index_heap;
+	// node_t, block_t and list_t for a block, node_t and miniblock_t for a
+	// miniblock, plus the list_t of the arena
+	uint64_t metadata = sizeof(list_t) +
+		num_blocks * (sizeof(node_t) + sizeof(block_t) + sizeof(list_t)) +
+		num_miniblocks * (sizeof(node_t) + sizeof(miniblock_t));
+	uint64_t metadata_heap = malloc_footprint(sizeof(list_t)) +
+		num_blocks * (malloc_footprint(sizeof(node_t)) +
+					  malloc_footprint(sizeof(block_t)) +
+					  malloc_footprint(sizeof(list_t))) +
+		num_miniblocks * (malloc_footprint(sizeof(node_t)) +
+						  malloc_footprint(sizeof(miniblock_t)));
+	// the array or tree of VMA_CONTAINER, on top of the lists
+	block_index_memory(arena, &index_used, &index_heap);
+	metadata += index_used, metadata_heap += index_heap;
+
+	// the buffers are rounded by the pool classes, malloc or huge pages
+	uint64_t buffers_heap = 0;
+	node_t *bsearch = arena->block_list->head;
+	while (bsearch) {
+		block_t *block = (block_t *)bsearch->info;
+		node_t *msearch = block->miniblock_list->head;
+		while (msearch) {
+			miniblock_t *miniblock = (miniblock_t *)msearch->info;
+			buffers_heap += pool_footprint(miniblock->size);
+			msearch = msearch->next;
+		}
+		bsearch = bsearch->next;
+	}
+	uint64_t packed = num_blocks * PACKED_BLOCK_SIZE +
+					  num_miniblocks * PACKED_MINIBLOCK_SIZE;
+	uint64_t overhead = metadata_heap - metadata +
+						buffers_heap - arena->used_mem;
+
+	out_str("Payload memory: 0x"), out_hex(arena->used_mem);
+	out_str(" bytes\nMetadata memory: 0x"), out_hex(metadata);
+	out_str(" bytes\nAllocator overhead: 0x"), out_hex(overhead);
+	out_str(" bytes\nMetadata per miniblock: ");
+	out_dec(num_miniblocks ? metadata_heap / num_miniblocks : 0);
+	out_str(" bytes\nPacked metadata: 0x"), out_hex(packed);
+	out_str(" bytes\nPacked saving: ");
+	out_dec(metadata_heap ? 100 - packed * 100 / metadata_heap : 0);
+	out_str("%\nPeak resident memory: "), out_dec(peak_resident());
+	out_str(" kB\n");
+}
@@ -0,0 +1,106 @@
+/*
+	Output engine: the messages of the commands are gathered in one big
+	buffer that goes to the sink in one piece when a command ends with no
+	other one waiting (or earlier, when the buffer is full); the sink is
+	stdout, the async writer or a client socket
+*/
+#include "vma.h"
+
+static char out_static[OUT_BUF_SIZE];
+static char *out_buf = out_static;
+static uint64_t out_len;
+static const out_sink_t *out_sink;
+
+// permission masks converted by table, same rule as permissions of files
+static const char *const perm_table[8] = {
+	"---", "--X", "-W-", "-WX", "R--", "R-X", "RW-", "RWX"
+};
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+// hands the buffer content to the sink (stdout is unbuffered: one write)
+void out_flush(void)
+{
+	if (!out_len)
+		return;
+	if (out_sink)
+		out_buf = out_sink->flush(out_sink->ctx, out_buf, out_len);
+	else
+		fwrite(out_buf, 1, out_len, stdout);
+	out_len = 0;
+}
+
+// flushes, then waits until the sink has written everything
+void out_drain(void)
+{
+	out_flush();
+	if (out_sink && out_sink->drain)
+		out_sink->drain(out_sink->ctx);
+}
+
+// the output so far goes to the old sink; NULL is stdout
+void out_set_sink(const out_sink_t *sink)
+{
+	out_flush();
+	out_sink = sink;
+	if (!sink)
+		out_buf = out_static;
+}
+
+// copies len bytes; the data bigger than the buffer goes in full buffers
+void out_mem(const char *s, uint64_t len)
+{
+	while (out_len + len > OUT_BUF_SIZE) {
+		uint64_t part = OUT_BUF_SIZE - out_len;
+		memcpy(out_buf + out_len, s, part);
+		out_len += part;
+		out_flush();
+		s += part, len -= part;
+	}
+	memcpy(out_buf + out_len, s, len);
+	out_len += len;
+}
+
+void out_str(const char *s)
+{
+	out_mem(s, strlen(s));
+}
+
+void out_char(char c)
+{
+	if (out_len == OUT_BUF_SIZE)
+		out_flush();
+	out_buf[out_len++] = c;
+}
+
+// same output as the %lu format specifier
+void out_dec(uint64_t x)
+{
+	char tmp[20];
+	int n = 0;
+	do {
+		tmp[n++] = (char)('0' + x % 10);
+		x /= 10;
+	} while (x);
+	while (n)
+		out_char(tmp[--n]);
+}
+
+// same output as the %lX format specifier, one nibble at a time
+void out_hex(uint64_t x)
+{
+	char tmp[16];
+	int n = 0;
+	do {
+		tmp[n++] = hex_digits[x & 0xF];
+		x >>= 4;
+	} while (x);
+	while (n)
+		out_char(tmp[--n]);
+}
+
+// the result is a constant string, no free needed
+const char *perm(uint8_t mask)
+{
+	return perm_table[mask & 7];
+}
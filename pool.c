@@ -0,0 +1,247 @@
+/*
+	Recycling pool for the rw_buffer allocations: free lists by size class
+	(powers of two), so repeated sizes stop going through malloc and free;
+	the buffers from HUGE_THRESHOLD up are mapped on 2 MB pages. With the
+	VMA_MMAP backing none of that is used: a buffer is the zone of its
+	miniblock in the mapping of the arena.
+*/
+#include "vma.h"
+#include "hugepage.h"
+#include "zone.h"
+
+// a retained buffer keeps the address of the next one in its first bytes
+typedef struct pool_item_t {
+	struct pool_item_t *next;
+} pool_item_t;
+
+static pool_item_t *pool_lists[POOL_CLASSES];
+static uint64_t pool_retained, pool_hits, pool_misses;
+// POOL_ZERO, or set for good by pool_zero_buffers
+static bool pool_zero = POOL_ZERO;
+// index of the smallest class that fits size, POOL_CLASSES if none
+static int pool_class(uint64_t size)
+{
+	int c = 0;
+	uint64_t class_size = POOL_MIN_SIZE;
+	while (class_size < size && c < POOL_CLASSES) {
+		class_size <<= 1;
+		c++;
+	}
+	return c;
+}
+
+void *pool_alloc(uint64_t size)
+{
+	int c = pool_class(size);
+	void *buf;
+	// the mapped buffers never go through the free lists, whatever the
+	// threshold is built with
+	if (size >= HUGE_THRESHOLD)
+		return huge_alloc(size);
+	if (VMA_POOL && c < POOL_CLASSES) {
+		if (pool_lists[c]) {
+			pool_item_t *item = pool_lists[c];
+			pool_lists[c] = item->next;
+			pool_retained -= (uint64_t)POOL_MIN_SIZE << c;
+			pool_hits++;
+			if (pool_zero)
+				memset(item, 0, (uint64_t)POOL_MIN_SIZE << c);
+			return item;
+		}
+		// only the sizes the pool could have served count as misses
+		pool_misses++;
+		size = (uint64_t)POOL_MIN_SIZE << c;
+	}
+	buf = pool_zero ? calloc(1, size) : malloc(size);
+	if (!buf) {
+		fprintf(stderr, "Malloc failed!\n");
+		exit(1);
+	}
+	return buf;
+}
+
+// gives the buffer back to the system; also called by the reclaimer thread
+void pool_release(void *buf, uint64_t size)
+{
+	if (size >= HUGE_THRESHOLD)
+		huge_free(buf, size);
+	else
+		free(buf);
+}
+
+/* size is the one given at pool_alloc; over the cap the buffer is freed and
+the mapped ones or the ones bigger than every class go to the background
+reclaimer */
+void pool_free(void *buf, uint64_t size)
+{
+	int c = pool_class(size);
+	if (!buf)
+		return;
+	if (VMA_BACKING == VMA_MMAP) {
+		zone_discard(buf, size);
+		return;
+	}
+	if (size >= HUGE_THRESHOLD || c == POOL_CLASSES) {
+		// the statistics stay on this thread
+		if (size >= HUGE_THRESHOLD)
+			huge_forget(buf);
+		if (VMA_RECLAIM)
+			reclaim_push(buf, size);
+		else
+			pool_release(buf, size);
+		return;
+	}
+	if (!VMA_POOL ||
+		pool_retained + ((uint64_t)POOL_MIN_SIZE << c) > POOL_CAP) {
+		free(buf);
+		return;
+	}
+	pool_item_t *item = (pool_item_t *)buf;
+	item->next = pool_lists[c];
+	pool_lists[c] = item;
+	pool_retained += (uint64_t)POOL_MIN_SIZE << c;
+}
+
+// keeps the first bytes of the buffer, like realloc
+static void *pool_move(void *buf, uint64_t old_size, uint64_t new_size)
+{
+	int c_old = pool_class(old_size), c_new = pool_class(new_size);
+	if (VMA_POOL && c_old == c_new && c_old < POOL_CLASSES &&
+		old_size < HUGE_THRESHOLD && new_size < HUGE_THRESHOLD)
+		return buf;
+	if (old_size >= HUGE_THRESHOLD && new_size >= HUGE_THRESHOLD &&
+		huge_length(old_size) == huge_length(new_size)) {
+		huge_resized(buf, new_size);
+		return buf;
+	}
+	if ((!VMA_POOL || (c_old == POOL_CLASSES && c_new == POOL_CLASSES)) &&
+		old_size < HUGE_THRESHOLD && new_size < HUGE_THRESHOLD) {
+		buf = realloc(buf, new_size);
+		if (!buf) {
+			fprintf(stderr, "Malloc failed!\n");
+			exit(1);
+		}
+		return buf;
+	}
+	void *new_buf = pool_alloc(new_size);
+	memcpy(new_buf, buf, old_size < new_size ? old_size : new_size);
+	pool_free(buf, old_size);
+	return new_buf;
+}
+
+// with VMA_MMAP the zone grows or shrinks where it is
+void *pool_resize(void *buf, uint64_t old_size, uint64_t new_size)
+{
+	if (VMA_BACKING != VMA_MMAP)
+		buf = pool_move(buf, old_size, new_size);
+	// a kept buffer may hold old bytes past old_size
+	if (pool_zero && new_size > old_size)
+		memset((char *)buf + old_size, 0, new_size - old_size);
+	return buf;
+}
+
+// bytes taken from the system for a buffer of size bytes
+uint64_t pool_footprint(uint64_t size)
+{
+	int c = pool_class(size);
+	if (VMA_BACKING == VMA_MMAP)
+		return size;
+	if (size >= HUGE_THRESHOLD)
+		return huge_length(size);
+	if (VMA_POOL && c < POOL_CLASSES)
+		size = (uint64_t)POOL_MIN_SIZE << c;
+	return malloc_footprint(size);
+}
+
+/* buffer of the miniblock of size bytes at address: buf if given (its
+bytes copied into the zone and buf freed with VMA_MMAP), a new one otherwise */
+void *pool_take(arena_t *arena, uint64_t address, uint64_t size, void *buf)
+{
+	if (VMA_BACKING != VMA_MMAP)
+		return buf ? buf : pool_alloc(size);
+	char *zone = arena->mapping + address;
+	if (buf && buf != zone) {
+		memcpy(zone, buf, size);
+		free(buf);
+	} else if (!buf && pool_zero) {
+		memset(zone, 0, size);
+	}
+	return zone;
+}
+
+/* buffer of a miniblock moved to new_address, keeping its first bytes; the
+zones may overlap with VMA_MMAP */
+void *pool_relocate(arena_t *arena, void *buf, uint64_t new_address,
+					uint64_t old_size, uint64_t new_size)
+{
+	if (VMA_BACKING != VMA_MMAP)
+		return pool_resize(buf, old_size, new_size);
+	char *zone = arena->mapping + new_address;
+	memmove(zone, buf, old_size < new_size ? old_size : new_size);
+	if (pool_zero && new_size > old_size)
+		memset(zone + old_size, 0, new_size - old_size);
+	return zone;
+}
+
+// a buffer kept out of the arena by a transaction, and its release
+void *pool_detach(void *buf, uint64_t size)
+{
+	if (VMA_BACKING != VMA_MMAP)
+		return buf;
+	void *copy = malloc(size);
+	if (!copy) {
+		fprintf(stderr, "Malloc failed!\n");
+		exit(1);
+	}
+	memcpy(copy, buf, size);
+	return copy;
+}
+
+void pool_free_detached(void *buf, uint64_t size)
+{
+	if (VMA_BACKING == VMA_MMAP)
+		free(buf);
+	else
+		pool_free(buf, size);
+}
+
+void pool_zero_buffers(void)
+{
+	pool_zero = true;
+}
+
+// gives all the retained buffers back to the system
+void pool_clear(void)
+{
+	for (int c = 0; c < POOL_CLASSES; c++) {
+		while (pool_lists[c]) {
+			pool_item_t *next = pool_lists[c]->next;
+			free(pool_lists[c]);
+			pool_lists[c] = next;
+		}
+	}
+	pool_retained = 0;
+}
+
+/* The pool and the huge pages belong to the process, so the numbers are
+those of every session; used_mem is the memory of the arenas live */
+void pool_stats(uint64_t used_mem, uint64_t arenas)
+{
+	uint64_t total = pool_hits + pool_misses;
+	out_str("Process-wide statistics, arenas: "), out_dec(arenas);
+	out_str("\nPool hits: "), out_dec(pool_hits);
+	out_str("\nPool misses: "), out_dec(pool_misses);
+	out_str("\nPool hit rate: "), out_dec(total ? pool_hits * 100 / total : 0);
+	out_str("%\nPool retained memory: 0x"), out_hex(pool_retained);
+	out_str(" bytes\n");
+	uint64_t huge_count, huge_total, huge_tlb, huge_thp;
+	huge_stats(&huge_count, &huge_total, &huge_tlb, &huge_thp);
+	out_str("Huge page threshold: 0x"), out_hex(HUGE_THRESHOLD);
+	out_str(" bytes\nHuge page buffers: "), out_dec(huge_count);
+	out_str("\nHuge page buffer memory: 0x"), out_hex(huge_total);
+	out_str(" bytes\nBacked by MAP_HUGETLB: 0x"), out_hex(huge_tlb);
+	out_str(" bytes\nBacked by transparent huge pages: 0x"), out_hex(huge_thp);
+	out_str(" bytes\nHuge page coverage: ");
+	out_dec(used_mem ? (huge_tlb + huge_thp) * 100 / used_mem : 0);
+	out_str("% of the memory of every arena\n");
+}
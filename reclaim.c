@@ -0,0 +1,84 @@
+/*
+	Background reclaimer: large buffers are handed to a second thread through
+	a lock-free single producer / single consumer ring, so their release does
+	not stall the command loop
+*/
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include "vma.h"
+
+typedef struct reclaim_item_t {
+	void *buf;
+	uint64_t size;
+} reclaim_item_t;
+
+static reclaim_item_t reclaim_ring[RECLAIM_QUEUE];
+// head is advanced only by the reclaimer, tail only by the command loop
+static uint64_t reclaim_head, reclaim_tail;
+static sem_t reclaim_items, reclaim_done;
+static pthread_t reclaim_thread;
+static bool reclaim_started;
+
+// releases items until it finds the stop marker (NULL buffer)
+static void *reclaim_loop(void *arg)
+{
+	(void)arg;
+	while (true) {
+		sem_wait(&reclaim_items);
+		uint64_t head = __atomic_load_n(&reclaim_head, __ATOMIC_RELAXED);
+		reclaim_item_t item = reclaim_ring[head % RECLAIM_QUEUE];
+		__atomic_store_n(&reclaim_head, head + 1, __ATOMIC_RELEASE);
+		if (!item.buf)
+			break;
+		pool_release(item.buf, item.size);
+	}
+	sem_post(&reclaim_done);
+	return NULL;
+}
+
+// false when the ring is full
+static bool reclaim_enqueue(void *buf, uint64_t size)
+{
+	uint64_t tail = reclaim_tail;
+	uint64_t head = __atomic_load_n(&reclaim_head, __ATOMIC_ACQUIRE);
+	if (tail - head == RECLAIM_QUEUE)
+		return false;
+	reclaim_ring[tail % RECLAIM_QUEUE].buf = buf;
+	reclaim_ring[tail % RECLAIM_QUEUE].size = size;
+	__atomic_store_n(&reclaim_tail, tail + 1, __ATOMIC_RELEASE);
+	sem_post(&reclaim_items);
+	return true;
+}
+
+// the thread is started at the first large buffer
+void reclaim_push(void *buf, uint64_t size)
+{
+	if (!reclaim_started) {
+		sem_init(&reclaim_items, 0, 0);
+		sem_init(&reclaim_done, 0, 0);
+		if (pthread_create(&reclaim_thread, NULL, reclaim_loop, NULL)) {
+			pool_release(buf, size);
+			return;
+		}
+		reclaim_started = true;
+	}
+	// bounded backlog: with a full ring the buffer is released right here
+	if (!reclaim_enqueue(buf, size))
+		pool_release(buf, size);
+}
+
+// waits until every queued buffer is released, then stops the thread
+void reclaim_drain(void)
+{
+	if (!reclaim_started)
+		return;
+	while (!reclaim_enqueue(NULL, 0))
+		sched_yield();
+	sem_wait(&reclaim_done);
+	pthread_join(reclaim_thread, NULL);
+	sem_destroy(&reclaim_items);
+	sem_destroy(&reclaim_done);
+	reclaim_started = false;
+}
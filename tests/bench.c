@@ -0,0 +1,240 @@
+/*
+	Throughput gate: every scenario is a generated command file, run by the
+	engine a few times; the best time gives its ops/sec. With --compare a
+	reference engine (built from another revision on the same machine) runs
+	the same files in turn with it, and a scenario slower than the reference
+	by more than the threshold (percent) fails the gate.
+
+	Usage: tests/bench ENGINE [--compare REF_ENGINE [PERCENT]]
+*/
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// commands of every scenario, after the setup
+#define BENCH_OPS 100000
+// runs of every scenario, the best one counts
+#define BENCH_RUNS 5
+// blocks alive in the scenarios, spread over the arena
+#define BENCH_BLOCKS 1024
+// blocks of the lookup scenario, where the block container matters
+#define LOOKUP_BLOCKS 8192
+#define DEF_THRESHOLD 15.0
+
+typedef struct scenario_t {
+	const char *name;
+	void (*gen)(FILE *f);
+} scenario_t;
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+// xorshift64*, the same inputs on every machine
+static uint64_t rnd(void)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 2685821657736338717ULL;
+}
+
+// blocks of size bytes, one every stride bytes
+static void gen_setup(FILE *f, uint64_t blocks, uint64_t stride,
+					  uint64_t size)
+{
+	fprintf(f, "ALLOC_ARENA %" PRIu64 "\n", stride * blocks);
+	for (uint64_t i = 0; i < blocks; i++)
+		fprintf(f, "ALLOC_BLOCK %" PRIu64 " %" PRIu64 "\n", i * stride, size);
+}
+
+static void gen_write(FILE *f, uint64_t address, uint64_t size)
+{
+	fprintf(f, "WRITE %" PRIu64 " %" PRIu64 " ", address, size);
+	for (uint64_t i = 0; i < size; i++)
+		fputc('a' + (int)(rnd() % 26), f);
+	fputc('\n', f);
+}
+
+// blocks taken and given back at random places
+static void gen_alloc_free(FILE *f)
+{
+	bool alive[BENCH_BLOCKS] = {false};
+	fprintf(f, "ALLOC_ARENA %d\n", 256 * BENCH_BLOCKS);
+	for (int i = 0; i < BENCH_OPS; i++) {
+		uint64_t slot = rnd() % BENCH_BLOCKS;
+		if (alive[slot])
+			fprintf(f, "FREE_BLOCK %" PRIu64 "\n", slot * 256);
+		else
+			fprintf(f, "ALLOC_BLOCK %" PRIu64 " 128\n", slot * 256);
+		alive[slot] = !alive[slot];
+	}
+}
+
+static void gen_read_write(FILE *f)
+{
+	gen_setup(f, BENCH_BLOCKS, 128, 64);
+	for (int i = 0; i < BENCH_OPS; i++) {
+		uint64_t address = rnd() % BENCH_BLOCKS * 128;
+		if (i % 2)
+			fprintf(f, "READ %" PRIu64 " 64\n", address);
+		else
+			gen_write(f, address, 64);
+	}
+}
+
+// pages of 16 miniblocks from random places
+static void gen_pmap(FILE *f)
+{
+	gen_setup(f, BENCH_BLOCKS, 128, 64);
+	for (int i = 0; i < BENCH_OPS; i++) {
+		uint64_t start = rnd() % BENCH_BLOCKS * 128;
+		fprintf(f, "PMAP %" PRIu64 " %" PRIu64 " 16\n", start,
+				start + 64 * 128);
+	}
+}
+
+// mostly in place, sometimes past the next block so the data moves
+static void gen_realloc(FILE *f)
+{
+	gen_setup(f, BENCH_BLOCKS, 4096, 64);
+	for (int i = 0; i < BENCH_OPS; i++) {
+		uint64_t address = rnd() % BENCH_BLOCKS * 4096;
+		uint64_t size = 1 + rnd() % (i % 16 ? 4096 : 8192);
+		fprintf(f, "REALLOC %" PRIu64 " %" PRIu64 "\n", address, size);
+	}
+}
+
+// short reads all over an arena of many blocks
+static void gen_lookup(FILE *f)
+{
+	gen_setup(f, LOOKUP_BLOCKS, 32, 16);
+	for (int i = 0; i < BENCH_OPS; i++)
+		fprintf(f, "READ %" PRIu64 " 16\n", rnd() % LOOKUP_BLOCKS * 32);
+}
+
+// transactions of eight writes and protection changes, half of them undone
+static void gen_tx(FILE *f)
+{
+	gen_setup(f, BENCH_BLOCKS, 128, 64);
+	for (int i = 0; i < BENCH_OPS; i += 10) {
+		fprintf(f, "BEGIN\n");
+		for (int j = 0; j < 8; j++) {
+			uint64_t address = rnd() % BENCH_BLOCKS * 128;
+			if (j == 7)
+				fprintf(f, "MPROTECT %" PRIu64 " PROT_READ | PROT_WRITE\n",
+						address);
+			else
+				gen_write(f, address, 64);
+		}
+		fprintf(f, "%s\n", rnd() % 2 ? "COMMIT" : "ABORT");
+	}
+}
+
+static const scenario_t scenarios[] = {
+	{"alloc_free", gen_alloc_free}, {"read_write", gen_read_write},
+	{"pmap", gen_pmap}, {"realloc", gen_realloc}, {"tx", gen_tx},
+	{"lookup", gen_lookup}
+};
+
+#define NUM_SCENARIOS (sizeof(scenarios) / sizeof(scenarios[0]))
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// seconds the engine takes on the input, the output goes to /dev/null
+static double run_engine(const char *engine, int in_fd)
+{
+	lseek(in_fd, 0, SEEK_SET);
+	double start = now();
+	pid_t pid = fork();
+	if (pid == 0) {
+		int null_fd = open("/dev/null", O_WRONLY);
+		dup2(in_fd, 0), dup2(null_fd, 1);
+		execl(engine, engine, (char *)NULL);
+		_exit(127);
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	double elapsed = now() - start;
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "%s failed\n", engine);
+		exit(1);
+	}
+	return elapsed;
+}
+
+/* ops/sec of the engine and of ref (if not NULL) on the scenario; their runs
+alternate, so a slower moment of the machine falls on both */
+static void measure(const char *engine, const char *ref,
+					const scenario_t *scenario, double *ops, double *ref_ops)
+{
+	char path[] = "/tmp/vma_bench_XXXXXX";
+	int fd = mkstemp(path);
+	FILE *f = fd < 0 ? NULL : fdopen(fd, "w+");
+	if (!f) {
+		perror("bench");
+		exit(1);
+	}
+	unlink(path);
+	scenario->gen(f);
+	fflush(f);
+	double best = 0, ref_best = 0;
+	for (int i = 0; i < BENCH_RUNS; i++) {
+		double t = run_engine(engine, fd);
+		if (!i || t < best)
+			best = t;
+		if (ref) {
+			t = run_engine(ref, fd);
+			if (!i || t < ref_best)
+				ref_best = t;
+		}
+	}
+	fclose(f);
+	*ops = BENCH_OPS / best;
+	*ref_ops = ref ? BENCH_OPS / ref_best : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *mode = argc > 2 ? argv[2] : "";
+	bool compare = strcmp(mode, "--compare") == 0;
+	if (argc < 2 || (compare && argc < 4) || (*mode && !compare)) {
+		fprintf(stderr, "Usage: %s ENGINE [--compare REF_ENGINE [PERCENT]]\n",
+				argv[0]);
+		return 1;
+	}
+	const char *ref = compare ? argv[3] : NULL;
+	double threshold = argc > 4 ? atof(argv[4]) : DEF_THRESHOLD;
+
+	int failed = 0;
+	for (uint64_t i = 0; i < NUM_SCENARIOS; i++) {
+		double ops, ref_ops;
+		measure(argv[1], ref, &scenarios[i], &ops, &ref_ops);
+		printf("%-12s %12.0f ops/sec", scenarios[i].name, ops);
+		if (ref) {
+			double change = 100.0 * (ops - ref_ops) / ref_ops;
+			printf("  reference %.0f, %+.1f%%", ref_ops, change);
+			if (change < -threshold) {
+				printf("  REGRESSION");
+				failed++;
+			}
+		}
+		printf("\n");
+	}
+	if (failed) {
+		printf("%d scenario(s) more than %.0f%% below the reference\n",
+			   failed, threshold);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,716 @@
+/*
+	Differential test: random command sequences run by the engine (the
+	debug build, with ASan and the arena check) and by a reference model,
+	a byte array for the arena and a sorted array of miniblocks, with no
+	lists, merges or splits. Both outputs must match byte for byte, and the
+	engine must exit cleanly: no sanitizer report, no failed check, no leak.
+
+	Usage: tests/fuzz ENGINE [RUNS [COMMANDS]]
+*/
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define PERM_READ 4
+#define PERM_WRITE 2
+#define DEF_PERM 6
+// lines printed by STATS and MEMSTAT, whose numbers are not compared
+#define STATS_LINES 11
+#define MEMSTAT_LINES 7
+
+typedef struct buf_t {
+	char *data;
+	uint64_t len, cap;
+} buf_t;
+
+typedef struct mini_t {
+	uint64_t start, size;
+	uint8_t perm;
+} mini_t;
+
+typedef struct model_t {
+	uint64_t size;
+	char *mem;
+	// sorted by start; a block is a run of miniblocks with no gap
+	mini_t *minis;
+	uint64_t num, cap;
+	bool in_tx;
+	// state at BEGIN, put back by ABORT
+	char *tx_mem;
+	mini_t *tx_minis;
+	uint64_t tx_num;
+} model_t;
+
+// a place in the expected output where the engine prints lines to skip
+typedef struct skip_t {
+	uint64_t offset;
+	int lines;
+} skip_t;
+
+// one run: the input, the expected output and where every command starts
+typedef struct run_t {
+	buf_t input, expected;
+	skip_t *skips;
+	uint64_t num_skips;
+	uint64_t *cmd_in, *cmd_out;
+	uint64_t num_cmds;
+} run_t;
+
+static const char *const perm_names[8] = {
+	"---", "--X", "-W-", "-WX", "R--", "R-X", "RW-", "RWX"
+};
+
+static uint64_t rng_state;
+
+// xorshift64*, the same sequence on every platform
+static uint64_t rnd(void)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 2685821657736338717ULL;
+}
+
+// uniform in [lo, hi]
+static uint64_t rnd_range(uint64_t lo, uint64_t hi)
+{
+	return lo + rnd() % (hi - lo + 1);
+}
+
+static void *xrealloc(void *p, uint64_t size)
+{
+	p = realloc(p, size ? size : 1);
+	if (!p) {
+		fprintf(stderr, "Malloc failed!\n");
+		exit(1);
+	}
+	return p;
+}
+
+static void buf_add(buf_t *buf, const char *data, uint64_t len)
+{
+	if (buf->len + len > buf->cap) {
+		buf->cap = buf->cap ? buf->cap : 4096;
+		while (buf->cap < buf->len + len)
+			buf->cap *= 2;
+		buf->data = xrealloc(buf->data, buf->cap);
+	}
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+}
+
+static void buf_printf(buf_t *buf, const char *fmt, ...)
+{
+	char tmp[256];
+	va_list args;
+	va_start(args, fmt);
+	int len = vsnprintf(tmp, sizeof(tmp), fmt, args);
+	va_end(args);
+	buf_add(buf, tmp, (uint64_t)len);
+}
+
+// index of the miniblock starting at address, -1 if none
+static int64_t find_start(const model_t *m, uint64_t address)
+{
+	for (uint64_t i = 0; i < m->num; i++)
+		if (m->minis[i].start == address)
+			return (int64_t)i;
+	return -1;
+}
+
+// index of the miniblock holding address, -1 if none
+static int64_t find_cover(const model_t *m, uint64_t address)
+{
+	for (uint64_t i = 0; i < m->num; i++)
+		if (m->minis[i].start <= address &&
+			address < m->minis[i].start + m->minis[i].size)
+			return (int64_t)i;
+	return -1;
+}
+
+// index of the last miniblock of the block holding miniblock i
+static uint64_t block_last(const model_t *m, uint64_t i)
+{
+	while (i + 1 < m->num &&
+		   m->minis[i].start + m->minis[i].size == m->minis[i + 1].start)
+		i++;
+	return i;
+}
+
+static void mini_insert(model_t *m, uint64_t start, uint64_t size,
+						uint8_t perm)
+{
+	uint64_t i = 0;
+	if (m->num == m->cap) {
+		m->cap = m->cap ? 2 * m->cap : 16;
+		m->minis = xrealloc(m->minis, m->cap * sizeof(mini_t));
+	}
+	while (i < m->num && m->minis[i].start < start)
+		i++;
+	memmove(&m->minis[i + 1], &m->minis[i], (m->num - i) * sizeof(mini_t));
+	m->minis[i] = (mini_t){start, size, perm};
+	m->num++;
+}
+
+static void mini_remove(model_t *m, uint64_t i)
+{
+	memmove(&m->minis[i], &m->minis[i + 1],
+			(m->num - i - 1) * sizeof(mini_t));
+	m->num--;
+}
+
+static uint64_t used_mem(const model_t *m)
+{
+	uint64_t used = 0;
+	for (uint64_t i = 0; i < m->num; i++)
+		used += m->minis[i].size;
+	return used;
+}
+
+static void model_alloc(model_t *m, buf_t *out, uint64_t address,
+						uint64_t size)
+{
+	if (address >= m->size) {
+		buf_printf(out, "The allocated address is outside the size of arena\n");
+		return;
+	}
+	if (address + size > m->size) {
+		buf_printf(out, "The end address is past the size of the arena\n");
+		return;
+	}
+	for (uint64_t i = 0; i < m->num; i++) {
+		if (m->minis[i].start < address + size &&
+			address < m->minis[i].start + m->minis[i].size) {
+			buf_printf(out, "This zone was already allocated.\n");
+			return;
+		}
+	}
+	memset(m->mem + address, 0, size);
+	mini_insert(m, address, size, DEF_PERM);
+}
+
+static void model_free(model_t *m, buf_t *out, uint64_t address)
+{
+	int64_t i = find_start(m, address);
+	if (i < 0)
+		buf_printf(out, "Invalid address for free.\n");
+	else
+		mini_remove(m, (uint64_t)i);
+}
+
+static void model_free_range(model_t *m, buf_t *out, uint64_t start,
+							 uint64_t end)
+{
+	uint64_t freed = 0;
+	for (uint64_t i = 0; i < m->num;) {
+		mini_t *mini = &m->minis[i];
+		if (mini->start >= start && mini->start + mini->size <= end) {
+			mini_remove(m, i);
+			freed++;
+		} else {
+			i++;
+		}
+	}
+	if (!freed)
+		buf_printf(out, "Invalid range for free.\n");
+}
+
+static void model_realloc(model_t *m, buf_t *out, uint64_t address,
+						  uint64_t new_size)
+{
+	int64_t i = find_start(m, address);
+	if (i < 0) {
+		buf_printf(out, "Invalid address for realloc.\n");
+		return;
+	}
+	if (!new_size) {
+		buf_printf(out, "Invalid size for realloc.\n");
+		return;
+	}
+	mini_t mini = m->minis[i];
+	if (new_size <= mini.size) {
+		m->minis[i].size = new_size;
+		buf_printf(out, "Block resized in place.\n");
+		return;
+	}
+	// the last miniblock of its block grows into the free zone after it
+	uint64_t end = address + mini.size, limit = m->size;
+	if ((uint64_t)i + 1 < m->num)
+		limit = m->minis[i + 1].start;
+	if (limit != end && limit - end >= new_size - mini.size) {
+		memset(m->mem + end, 0, new_size - mini.size);
+		m->minis[i].size = new_size;
+		buf_printf(out, "Block resized in place.\n");
+		return;
+	}
+	// first fit, with the old zone free
+	mini_remove(m, (uint64_t)i);
+	uint64_t prev_end = 0, new_address = 0;
+	bool found = false;
+	for (uint64_t k = 0; k <= m->num && !found; k++) {
+		uint64_t next = k < m->num ? m->minis[k].start : m->size;
+		if (next - prev_end >= new_size)
+			new_address = prev_end, found = true;
+		else if (k < m->num)
+			prev_end = m->minis[k].start + m->minis[k].size;
+	}
+	if (!found) {
+		mini_insert(m, address, mini.size, mini.perm);
+		buf_printf(out, "Not enough free memory for realloc.\n");
+		return;
+	}
+	char *data = xrealloc(NULL, mini.size);
+	memcpy(data, m->mem + address, mini.size);
+	memset(m->mem + new_address, 0, new_size);
+	memcpy(m->mem + new_address, data, mini.size);
+	free(data);
+	mini_insert(m, new_address, new_size, mini.perm);
+	if (new_address == address)
+		buf_printf(out, "Block resized in place.\n");
+	else
+		buf_printf(out, "Block moved to 0x%" PRIX64 ".\n", new_address);
+}
+
+/* READ and WRITE: the size check counts the whole first miniblock, as the
+engine does, and the copy stops at the end of the block */
+static void model_access(model_t *m, buf_t *out, uint64_t address,
+						 uint64_t size, const char *data)
+{
+	const char *name = data ? "write" : "read";
+	uint8_t mask = data ? PERM_WRITE : PERM_READ;
+	int64_t i = find_cover(m, address);
+	if (i < 0) {
+		buf_printf(out, "Invalid address for %s.\n", name);
+		return;
+	}
+	uint64_t last = block_last(m, (uint64_t)i), total = 0;
+	for (uint64_t k = (uint64_t)i; k <= last; k++) {
+		if ((m->minis[k].perm & mask) != mask) {
+			buf_printf(out, "Invalid permissions for %s.\n", name);
+			return;
+		}
+		total += m->minis[k].size;
+	}
+	if (total < size) {
+		buf_printf(out, "Warning: size was bigger than the block size. ");
+		buf_printf(out, "%s %" PRIu64 " characters.\n",
+				   data ? "Writing" : "Reading", total);
+		size = total;
+	}
+	uint64_t block_end = m->minis[last].start + m->minis[last].size;
+	if (size > block_end - address)
+		size = block_end - address;
+	if (data) {
+		memcpy(m->mem + address, data, size);
+	} else {
+		buf_add(out, m->mem + address, size);
+		buf_add(out, "\n", 1);
+	}
+}
+
+static void model_mprotect(model_t *m, buf_t *out, uint64_t address,
+						   uint8_t perm)
+{
+	int64_t i = find_start(m, address);
+	if (i < 0)
+		buf_printf(out, "Invalid address for mprotect.\n");
+	else
+		m->minis[i].perm = perm;
+}
+
+// the blocks are rebuilt from the miniblocks, then printed like pmap_range
+static void model_pmap(const model_t *m, buf_t *out, uint64_t start,
+					   uint64_t end, uint64_t limit)
+{
+	uint64_t *first = xrealloc(NULL, (m->num + 1) * sizeof(uint64_t));
+	uint64_t num_blocks = 0, printed = 0;
+	for (uint64_t k = 0; k < m->num; k = block_last(m, k) + 1)
+		first[num_blocks++] = k;
+	first[num_blocks] = m->num;
+
+	buf_printf(out, "Total memory: 0x%" PRIX64 " bytes\n", m->size);
+	buf_printf(out, "Free memory: 0x%" PRIX64 " bytes\n", m->size - used_mem(m));
+	buf_printf(out, "Number of allocated blocks: %" PRIu64 "\n", num_blocks);
+	buf_printf(out, "Number of allocated miniblocks: %" PRIu64 "\n", m->num);
+	for (uint64_t b = 0; b < num_blocks; b++) {
+		const mini_t *head = &m->minis[first[b]];
+		const mini_t *tail = &m->minis[first[b + 1] - 1];
+		uint64_t bstart = head->start, bend = tail->start + tail->size;
+		if (bend <= start)
+			continue;
+		if (bstart >= end)
+			break;
+		buf_printf(out, "\nBlock %" PRIu64 " begin\n", b + 1);
+		buf_printf(out, "Zone: 0x%" PRIX64 " - 0x%" PRIX64 "\n", bstart, bend);
+		for (uint64_t k = first[b]; k < first[b + 1]; k++) {
+			const mini_t *mini = &m->minis[k];
+			if (mini->start >= end)
+				break;
+			if (mini->start + mini->size <= start)
+				continue;
+			if (limit && printed == limit) {
+				buf_printf(out, "Block %" PRIu64 " end\n", b + 1);
+				buf_printf(out, "\nNext: 0x%" PRIX64 "\n", mini->start);
+				free(first);
+				return;
+			}
+			buf_printf(out, "Miniblock %" PRIu64 ":\t\t0x%" PRIX64
+					   "\t\t-\t\t0x%" PRIX64 "\t\t| %s\n", k - first[b] + 1,
+					   mini->start, mini->start + mini->size,
+					   perm_names[mini->perm & 7]);
+			printed++;
+		}
+		buf_printf(out, "Block %" PRIu64 " end\n", b + 1);
+		if (limit && printed == limit && b + 1 < num_blocks &&
+			m->minis[first[b + 1]].start < end) {
+			buf_printf(out, "\nNext: 0x%" PRIX64 "\n",
+					   m->minis[first[b + 1]].start);
+			break;
+		}
+	}
+	free(first);
+}
+
+static void model_begin(model_t *m, buf_t *out)
+{
+	if (m->in_tx) {
+		buf_printf(out, "Transaction already started.\n");
+		return;
+	}
+	m->in_tx = true;
+	m->tx_mem = xrealloc(m->tx_mem, m->size);
+	memcpy(m->tx_mem, m->mem, m->size);
+	m->tx_minis = xrealloc(m->tx_minis, m->num * sizeof(mini_t));
+	memcpy(m->tx_minis, m->minis, m->num * sizeof(mini_t));
+	m->tx_num = m->num;
+}
+
+static void model_end_tx(model_t *m, buf_t *out, bool abort_tx)
+{
+	if (!m->in_tx) {
+		buf_printf(out, "No transaction started.\n");
+		return;
+	}
+	m->in_tx = false;
+	if (!abort_tx)
+		return;
+	memcpy(m->mem, m->tx_mem, m->size);
+	if (m->tx_num > m->cap) {
+		m->cap = m->tx_num;
+		m->minis = xrealloc(m->minis, m->cap * sizeof(mini_t));
+	}
+	memcpy(m->minis, m->tx_minis, m->tx_num * sizeof(mini_t));
+	m->num = m->tx_num;
+}
+
+// an address near the miniblocks most of the time
+static uint64_t gen_address(const model_t *m)
+{
+	uint64_t r = rnd() % 10;
+	if (m->num && r < 5)
+		return m->minis[rnd() % m->num].start;
+	if (m->num && r < 7) {
+		const mini_t *mini = &m->minis[rnd() % m->num];
+		return mini->start + rnd_range(0, mini->size + 8);
+	}
+	return rnd_range(0, m->size + 16);
+}
+
+static uint64_t gen_size(const model_t *m)
+{
+	uint64_t r = rnd() % 20;
+	if (r < 14)
+		return rnd_range(1, 32);
+	if (r < 19)
+		return rnd_range(33, 256);
+	return rnd_range(1, m->size / 2 + 1);
+}
+
+// PROT_ tokens joined by " | ", and the mask permission_convert makes
+static uint8_t gen_perm(buf_t *in)
+{
+	static const char *const names[] = {
+		"PROT_NONE", "PROT_READ", "PROT_WRITE", "PROT_EXEC"
+	};
+	static const uint8_t bits[] = {0, 4, 2, 1};
+	uint8_t perm = 0;
+	int n = (int)rnd_range(1, 3);
+	for (int i = 0; i < n; i++) {
+		int t = (int)(rnd() % 4);
+		buf_printf(in, "%s%s", i ? " | " : " ", names[t]);
+		perm = t ? perm | bits[t] : 0;
+	}
+	buf_add(in, "\n", 1);
+	return perm;
+}
+
+static void add_skip(run_t *run, int lines)
+{
+	run->skips = xrealloc(run->skips, (run->num_skips + 1) * sizeof(skip_t));
+	run->skips[run->num_skips++] = (skip_t){run->expected.len, lines};
+}
+
+// one random command, appended to the input, with its expected output
+static void gen_command(model_t *m, run_t *run)
+{
+	buf_t *in = &run->input, *out = &run->expected;
+	uint64_t a = gen_address(m), b, r = rnd() % 100;
+	if (r < 22) {
+		// right after a miniblock half of the time, to grow the blocks
+		if (m->num && rnd() % 2) {
+			const mini_t *mini = &m->minis[rnd() % m->num];
+			a = mini->start + mini->size;
+		}
+		b = gen_size(m);
+		buf_printf(in, "ALLOC_BLOCK %" PRIu64 " %" PRIu64 "\n", a, b);
+		model_alloc(m, out, a, b);
+	} else if (r < 34) {
+		buf_printf(in, "FREE_BLOCK %" PRIu64 "\n", a);
+		model_free(m, out, a);
+	} else if (r < 50) {
+		char data[128];
+		b = rnd_range(0, 100);
+		for (uint64_t i = 0; i < b; i++)
+			data[i] = (char)('a' + rnd() % 26);
+		buf_printf(in, "WRITE %" PRIu64 " %" PRIu64 " ", a, b);
+		buf_add(in, data, b);
+		buf_add(in, "\n", 1);
+		if (b > m->size)
+			buf_printf(out, "Invalid size for write.\n");
+		else
+			model_access(m, out, a, b, data);
+	} else if (r < 64) {
+		b = rnd_range(0, 120);
+		buf_printf(in, "READ %" PRIu64 " %" PRIu64 "\n", a, b);
+		model_access(m, out, a, b, NULL);
+	} else if (r < 71) {
+		buf_printf(in, "MPROTECT %" PRIu64, a);
+		model_mprotect(m, out, a, gen_perm(in));
+	} else if (r < 78) {
+		b = rnd() % 4 ? gen_size(m) : rnd_range(0, 8);
+		buf_printf(in, "REALLOC %" PRIu64 " %" PRIu64 "\n", a, b);
+		if (m->in_tx)
+			buf_printf(out, "Operation not allowed in a transaction.\n");
+		else
+			model_realloc(m, out, a, b);
+	} else if (r < 82) {
+		b = a + rnd_range(0, 128);
+		// from a miniblock to the end of a later one, often inside a block
+		if (m->num && rnd() % 2) {
+			uint64_t i = rnd() % m->num, k = i + rnd() % 3;
+			k = k < m->num ? k : m->num - 1;
+			a = m->minis[i].start, b = m->minis[k].start + m->minis[k].size;
+		}
+		if (rnd() % 8 == 0)
+			b = rnd_range(0, a);
+		buf_printf(in, "FREE_RANGE %" PRIu64 " %" PRIu64 "\n", a, b);
+		if (m->in_tx)
+			buf_printf(out, "Operation not allowed in a transaction.\n");
+		else
+			model_free_range(m, out, a, b);
+	} else if (r < 88) {
+		uint64_t kind = rnd() % 5;
+		b = a + rnd_range(0, m->size);
+		if (kind == 0) {
+			buf_printf(in, "PMAP\n");
+			model_pmap(m, out, 0, m->size, 0);
+		} else if (kind == 1) {
+			buf_printf(in, "PMAP %" PRIu64 "\n", a);
+			buf_printf(out, "Invalid arguments for pmap.\n");
+		} else if (kind == 2) {
+			buf_printf(in, "PMAP %" PRIu64 " %" PRIu64 "\n", a, b);
+			model_pmap(m, out, a, b, 0);
+		} else {
+			uint64_t limit = rnd_range(0, 6);
+			// the start in hex, as the Next cursor prints it, or with a
+			// leading zero that stays decimal
+			if (kind == 3)
+				buf_printf(in, "PMAP 0x%" PRIX64, a);
+			else
+				buf_printf(in, "PMAP 0%" PRIu64, a);
+			buf_printf(in, " %" PRIu64 " %" PRIu64 "\n", b, limit);
+			model_pmap(m, out, a, b, limit);
+		}
+	} else if (r < 91) {
+		buf_printf(in, "BEGIN\n");
+		model_begin(m, out);
+	} else if (r < 93) {
+		buf_printf(in, "COMMIT\n");
+		model_end_tx(m, out, false);
+	} else if (r < 96) {
+		buf_printf(in, "ABORT\n");
+		model_end_tx(m, out, true);
+	} else if (r < 97) {
+		buf_printf(in, "STATS\n");
+		add_skip(run, STATS_LINES);
+	} else if (r < 98) {
+		buf_printf(in, "MEMSTAT\n");
+		add_skip(run, MEMSTAT_LINES);
+	} else {
+		buf_printf(in, "NOPE\n");
+		buf_printf(out, "Invalid command. Please try again.\n");
+	}
+}
+
+static void gen_run(run_t *run, uint64_t commands)
+{
+	model_t m;
+	memset(&m, 0, sizeof(m));
+	m.size = rnd() % 4 ? rnd_range(64, 2048) : rnd_range(2049, 1 << 16);
+	m.mem = xrealloc(NULL, m.size);
+	run->cmd_in = xrealloc(NULL, (commands + 1) * sizeof(uint64_t));
+	run->cmd_out = xrealloc(NULL, (commands + 1) * sizeof(uint64_t));
+	buf_printf(&run->input, "ALLOC_ARENA %" PRIu64 "\n", m.size);
+	for (uint64_t i = 0; i < commands; i++) {
+		run->cmd_in[i] = run->input.len, run->cmd_out[i] = run->expected.len;
+		gen_command(&m, run);
+	}
+	run->num_cmds = commands;
+	run->cmd_in[commands] = run->input.len;
+	run->cmd_out[commands] = run->expected.len;
+	// the end of the input releases the arena, like DEALLOC_ARENA
+	if (rnd() % 2)
+		buf_printf(&run->input, "DEALLOC_ARENA\n");
+	free(m.mem);
+	free(m.minis);
+	free(m.tx_mem);
+	free(m.tx_minis);
+}
+
+// runs engine on the input; false if it crashed or wrote to stderr
+static bool run_engine(const char *engine, const buf_t *input, buf_t *output,
+					   buf_t *errors)
+{
+	char in_path[] = "/tmp/vma_fuzz_XXXXXX", err_path[] = "/tmp/vma_err_XXXXXX";
+	int in_fd = mkstemp(in_path), err_fd = mkstemp(err_path), pipe_fd[2];
+	if (in_fd < 0 || err_fd < 0 || pipe(pipe_fd) < 0) {
+		perror("fuzz");
+		exit(1);
+	}
+	unlink(in_path), unlink(err_path);
+	FILE *f = fdopen(in_fd, "w+");
+	if (!f || fwrite(input->data, 1, input->len, f) != input->len ||
+		fflush(f)) {
+		perror("fuzz");
+		exit(1);
+	}
+	lseek(in_fd, 0, SEEK_SET);
+	pid_t pid = fork();
+	if (pid == 0) {
+		dup2(in_fd, 0), dup2(pipe_fd[1], 1), dup2(err_fd, 2);
+		close(pipe_fd[0]);
+		execl(engine, engine, (char *)NULL);
+		_exit(127);
+	}
+	close(pipe_fd[1]);
+	FILE *in = f;
+	f = fdopen(pipe_fd[0], "r");
+	char chunk[65536];
+	size_t n;
+	while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+		buf_add(output, chunk, n);
+	fclose(f);
+	int status;
+	waitpid(pid, &status, 0);
+	lseek(err_fd, 0, SEEK_SET);
+	f = fdopen(err_fd, "r");
+	while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+		buf_add(errors, chunk, n);
+	fclose(f);
+	fclose(in);
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0 && !errors->len;
+}
+
+/* offset in the expected output of the first difference, -1 if none; the
+lines of STATS and MEMSTAT are skipped */
+static int64_t compare(const run_t *run, const buf_t *output)
+{
+	uint64_t e = 0, o = 0, s = 0;
+	const buf_t *exp = &run->expected;
+	while (true) {
+		uint64_t stop = s < run->num_skips ? run->skips[s].offset : exp->len;
+		while (e < stop) {
+			if (o >= output->len || output->data[o] != exp->data[e])
+				return (int64_t)e;
+			e++, o++;
+		}
+		if (s == run->num_skips)
+			return o == output->len ? -1 : (int64_t)e;
+		for (int lines = run->skips[s++].lines; lines; o++) {
+			if (o >= output->len)
+				return (int64_t)e;
+			if (output->data[o] == '\n')
+				lines--;
+		}
+	}
+}
+
+static void report(uint64_t seed, const run_t *run, const buf_t *output,
+				   int64_t offset)
+{
+	uint64_t k = 0, len;
+	while (k < run->num_cmds && run->cmd_out[k + 1] <= (uint64_t)offset)
+		k++;
+	fprintf(stderr, "seed %" PRIu64 ": output differs at command %" PRIu64
+			": %.*s", seed, k + 1,
+			(int)(run->cmd_in[k + 1] - run->cmd_in[k]),
+			run->input.data + run->cmd_in[k]);
+	fprintf(stderr, "expected: %.*s\n",
+			(int)(run->cmd_out[k + 1] - run->cmd_out[k]),
+			run->expected.data + run->cmd_out[k]);
+	// the engine output from the same point, as far as the skips allow
+	if (run->cmd_out[k] > output->len)
+		len = 0;
+	else
+		len = output->len - run->cmd_out[k];
+	fprintf(stderr, "engine: %.*s\n", (int)(len < 200 ? len : 200),
+			output->data + run->cmd_out[k]);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s ENGINE [RUNS [COMMANDS]]\n", argv[0]);
+		return 1;
+	}
+	uint64_t runs = argc > 2 ? strtoull(argv[2], NULL, 10) : 200;
+	uint64_t commands = argc > 3 ? strtoull(argv[3], NULL, 10) : 400;
+	for (uint64_t seed = 1; seed <= runs; seed++) {
+		run_t run;
+		buf_t output = {0}, errors = {0};
+		memset(&run, 0, sizeof(run));
+		rng_state = seed * 0x9E3779B97F4A7C15ULL;
+		gen_run(&run, commands);
+		bool clean = run_engine(argv[1], &run.input, &output, &errors);
+		int64_t offset = compare(&run, &output);
+		if (!clean || offset >= 0) {
+			char path[64];
+			snprintf(path, sizeof(path), "fuzz_%" PRIu64 ".in", seed);
+			FILE *f = fopen(path, "w");
+			if (f) {
+				fwrite(run.input.data, 1, run.input.len, f);
+				fclose(f);
+			}
+			if (!clean)
+				fprintf(stderr, "seed %" PRIu64 ": engine failed\n%.*s", seed,
+						(int)errors.len, errors.data);
+			if (offset >= 0)
+				report(seed, &run, &output, offset);
+			fprintf(stderr, "input saved in %s\n", path);
+			return 1;
+		}
+		free(run.input.data), free(run.expected.data), free(run.skips);
+		free(run.cmd_in), free(run.cmd_out);
+		free(output.data), free(errors.data);
+	}
+	printf("%" PRIu64 " runs of %" PRIu64 " commands: same output\n", runs,
+		   commands);
+	return 0;
+}
@@ -0,0 +1,202 @@
+/*
+	Transactions on the arena: between BEGIN and COMMIT every ALLOC_BLOCK,
+	FREE_BLOCK, WRITE and MPROTECT leaves an undo entry, replayed backwards by
+	ABORT. WRITE and MPROTECT are undone through the miniblock pointer in
+	their entries; ALLOC_BLOCK and FREE_BLOCK go through free_block and
+	alloc_block, so they search the block index again
+*/
+#include "vma.h"
+
+/* Node of the miniblock holding address, NULL if there is none. The
+undo entries keep miniblock pointers: they stay valid in a transaction,
+because merges and splits only relink the nodes and REALLOC and FREE_RANGE
+are refused. */
+static node_t *find_covering(const arena_t *arena, uint64_t address)
+{
+	node_t *bsearch = block_index_floor(arena, address, NULL);
+	if (!bsearch)
+		return NULL;
+	block_t *block = (block_t *)bsearch->info;
+	if (address >= block->start_address + block->size)
+		return NULL;
+	node_t *msearch = block->miniblock_list->head;
+	while (msearch) {
+		miniblock_t *miniblock = (miniblock_t *)msearch->info;
+		if (address < miniblock->start_address + miniblock->size)
+			return msearch;
+		msearch = msearch->next;
+	}
+	return NULL;
+}
+
+static void tx_log(arena_t *arena, uint8_t type, uint64_t address,
+				   uint64_t size, uint8_t perm, miniblock_t *miniblock,
+				   void *data)
+{
+	if (arena->undo_len == arena->undo_cap) {
+		arena->undo_cap = arena->undo_cap ? 2 * arena->undo_cap : 16;
+		arena->undo_log = realloc(arena->undo_log,
+								  arena->undo_cap * sizeof(undo_entry_t));
+		if (!arena->undo_log) {
+			fprintf(stderr, "Malloc failed!\n");
+			exit(1);
+		}
+	}
+	undo_entry_t *entry = &arena->undo_log[arena->undo_len++];
+	entry->type = type, entry->perm = perm;
+	entry->address = address, entry->size = size;
+	entry->miniblock = miniblock, entry->data = data;
+}
+
+void tx_begin(arena_t *arena)
+{
+	if (arena->in_tx) {
+		out_str("Transaction already started.\n");
+		return;
+	}
+	arena->in_tx = true;
+	arena->undo_len = 0;
+}
+
+// the changes stay; detached buffers and saved bytes are released
+void tx_commit(arena_t *arena)
+{
+	if (!arena->in_tx) {
+		out_str("No transaction started.\n");
+		return;
+	}
+	for (uint64_t i = 0; i < arena->undo_len; i++) {
+		undo_entry_t *entry = &arena->undo_log[i];
+		if (entry->type == UNDO_FREE) {
+			pool_free_detached(entry->miniblock->rw_buffer,
+							   entry->miniblock->size);
+			free(entry->miniblock);
+		} else if (entry->type == UNDO_WRITE) {
+			free(entry->data);
+		}
+	}
+	free(arena->undo_log);
+	arena->undo_log = NULL;
+	arena->undo_len = 0, arena->undo_cap = 0;
+	arena->in_tx = false;
+}
+
+// the log is replayed from the last entry to the first
+void tx_abort(arena_t *arena)
+{
+	if (!arena->in_tx) {
+		out_str("No transaction started.\n");
+		return;
+	}
+	while (arena->undo_len) {
+		undo_entry_t *entry = &arena->undo_log[--arena->undo_len];
+		miniblock_t *miniblock = entry->miniblock;
+		node_t *m_node;
+		switch (entry->type) {
+		case UNDO_ALLOC:
+			free_block(arena, entry->address);
+			break;
+		case UNDO_FREE:
+			/* same zone again with the old buffer, then the old miniblock
+			takes the new one's place, so the older entries still point at
+			it; with VMA_MMAP the kept bytes were copied back into the zone */
+			alloc_block_buf(arena, entry->address, entry->size,
+							miniblock->rw_buffer);
+			m_node = find_m_node(arena, entry->address);
+			miniblock->rw_buffer = ((miniblock_t *)m_node->info)->rw_buffer;
+			free(m_node->info);
+			m_node->info = miniblock;
+			break;
+		case UNDO_WRITE:
+			memcpy((char *)miniblock->rw_buffer +
+				   (entry->address - miniblock->start_address),
+				   entry->data, entry->size);
+			free(entry->data);
+			break;
+		case UNDO_PERM:
+			miniblock->perm = entry->perm;
+			break;
+		}
+	}
+	free(arena->undo_log);
+	arena->undo_log = NULL;
+	arena->undo_cap = 0;
+	arena->in_tx = false;
+}
+
+void tx_alloc_block(arena_t *arena, const uint64_t address,
+					const uint64_t size)
+{
+	uint64_t num_miniblocks = arena->num_miniblocks;
+	alloc_block(arena, address, size);
+	if (arena->in_tx && arena->num_miniblocks != num_miniblocks)
+		tx_log(arena, UNDO_ALLOC, address, size, 0, NULL, NULL);
+}
+
+/* The miniblock is detached before free_block (a copy without buffer is
+freed in its place), so ABORT can put it back whole; with VMA_MMAP the zone
+may be taken again, so the detached miniblock keeps a copy of the bytes */
+void tx_free_block(arena_t *arena, const uint64_t address)
+{
+	if (arena->in_tx) {
+		node_t *m_node = find_m_node(arena, address);
+		if (m_node) {
+			miniblock_t *miniblock = (miniblock_t *)m_node->info;
+			miniblock_t *spare = malloc(sizeof(*spare));
+			if (!spare) {
+				fprintf(stderr, "Malloc failed!\n");
+				exit(1);
+			}
+			*spare = *miniblock;
+			spare->rw_buffer = NULL;
+			m_node->info = spare;
+			miniblock->rw_buffer = pool_detach(miniblock->rw_buffer,
+											   miniblock->size);
+			tx_log(arena, UNDO_FREE, address, miniblock->size, 0, miniblock,
+				   NULL);
+		}
+	}
+	free_block(arena, address);
+}
+
+void tx_write(arena_t *arena, const uint64_t address,
+			  const uint64_t size, char *data)
+{
+	uint64_t total;
+	node_t *m_node = arena->in_tx ? find_covering(arena, address) : NULL;
+	// the bytes write will change, one entry per miniblock: no more than
+	// what is left in the block, whatever size the client gave
+	if (m_node && check_perm_range(m_node, PERM_WRITE, &total)) {
+		uint64_t addr = address, left = size;
+		while (m_node && left) {
+			miniblock_t *miniblock = (miniblock_t *)m_node->info;
+			uint64_t j = addr - miniblock->start_address;
+			uint64_t len = miniblock->size - j;
+			if (len > left)
+				len = left;
+			char *old = malloc(len);
+			if (!old) {
+				fprintf(stderr, "Malloc failed!\n");
+				exit(1);
+			}
+			memcpy(old, (char *)miniblock->rw_buffer + j, len);
+			tx_log(arena, UNDO_WRITE, addr, len, 0, miniblock, old);
+			addr += len, left -= len;
+			m_node = m_node->next;
+		}
+	}
+	write(arena, address, size, data);
+}
+
+void tx_mprotect(arena_t *arena, uint64_t address, uint8_t *permission)
+{
+	if (arena->in_tx) {
+		node_t *m_node = find_m_node(arena, address);
+		if (m_node) {
+			miniblock_t *miniblock = (miniblock_t *)m_node->info;
+			tx_log(arena, UNDO_PERM, address, 0, miniblock->perm, miniblock,
+				   NULL);
+		}
+	}
+	mprotect(arena, address, permission);
+}
@@ -1,9 +1,22 @@
 #include "vma.h"
+#include "zone.h"
 
-void alloc_arena(const uint64_t size, arena_t *arena)
+// false only with VMA_MMAP, when the arena can't be mapped
+bool alloc_arena(const uint64_t size, arena_t *arena)
 {
+	arena->mapping = NULL;
+	if (VMA_BACKING == VMA_MMAP && size) {
+		arena->mapping = zone_map(size);
+		if (!arena->mapping)
+			return false;
+	}
 	arena->arena_size = size;
 	arena->block_list = dll_create(sizeof(block_t));
+	arena->block_index = block_index_create();
+	arena->used_mem = 0, arena->num_miniblocks = 0;
+	arena->in_tx = false, arena->undo_log = NULL;
+	arena->undo_len = 0, arena->undo_cap = 0;
+	return true;
 }
 
 /* Freeing nodes and lists from arena, method: order of freeing: rw_buffer,
@@ -14,6 +27,10 @@ void dealloc_arena(arena_t *arena)
 	list_t *b_list = arena->block_list;
 	node_t *bsearch = b_list->head;
 
+	// an open transaction is kept, releasing its log
+	if (arena->in_tx)
+		tx_commit(arena);
+
 	// traversing lists and deleting from last to first in the hierarchy
 	while (bsearch) {
 		node_t *bnext = bsearch->next;
@@ -23,7 +40,7 @@ void dealloc_arena(arena_t *arena)
 		while (msearch) {
 			node_t *mnext = msearch->next;
 			miniblock_t *miniblock = (miniblock_t *)msearch->info;
-			free(miniblock->rw_buffer);
+			pool_free(miniblock->rw_buffer, miniblock->size);
 			// impossible to be NULL
 			free(miniblock);
 			free(msearch);
@@ -34,7 +51,13 @@ void dealloc_arena(arena_t *arena)
 		free(bsearch);
 		bsearch = bnext;
 	}
+	block_index_free(arena);
 	free(b_list);
+	if (arena->mapping)
+		zone_unmap(arena->mapping, arena->arena_size);
+	// the large buffers still queued are released before returning
+	reclaim_drain();
+	pool_clear();
 }
 
 /* Blocks will be allocated in increasing order of their addresses and total
@@ -46,13 +69,22 @@ possible. */
 // it's possible to free miniblocks correctly, because no rw_buffer allocated
 // when adding
 void alloc_block(arena_t *arena, const uint64_t address, const uint64_t size)
+{
+	alloc_block_buf(arena, address, size, NULL);
+}
+
+/* alloc_block with a given rw_buffer (from pool_take, of size bytes), used
+when a buffer moves from a miniblock to another; NULL takes a new one. On
+failure the buffer still belongs to the caller. */
+void alloc_block_buf(arena_t *arena, const uint64_t address,
+					 const uint64_t size, void *buf)
 {
 	if (address >= arena->arena_size) {
-		printf("The allocated address is outside the size of arena\n");
+		out_str("The allocated address is outside the size of arena\n");
 		return;
 	}
 	if (address + size > arena->arena_size) {
-		printf("The end address is past the size of the arena\n");
+		out_str("The end address is past the size of the arena\n");
 		return;
 	}
 
@@ -79,36 +111,29 @@ void alloc_block(arena_t *arena, const uint64_t address, const uint64_t size)
 			exit(1);
 		}
 		miniblock->start_address = address, miniblock->size = size;
-		miniblock->perm = DEF_PERM, miniblock->rw_buffer = malloc(size);
+		miniblock->perm = DEF_PERM, miniblock->rw_buffer = pool_take(arena, address, size, buf);
 		add_nth_node(block->miniblock_list, 0, (const void *)miniblock);
 		free(miniblock);
 		add_nth_node(arena->block_list, 0, (const void *)block);
+		block_index_insert(arena, arena->block_list->head);
 		// block was used only for copying data
 		free(block);
+		arena->used_mem += size, arena->num_miniblocks++;
 		return;
 	}
-	// moving to a location where address is between 2 block addresses
-	search = arena->block_list->head;
-	block_t *block = (block_t *)search->info;
-	prev = NULL;
-	while (address > block->start_address && search) {
-		prev = search;
-		search = search->next;
-		// update the block->address
-		if (search)
-			block = (block_t *)search->info;
-	}
+	// moving to a location where address is between 2 block addresses:
+	// prev = the last block that starts before address
+	prev = address ? block_index_floor(arena, address - 1, NULL) : NULL;
 	// search	new_node	search->next
 
 	// to work in add first concatenate case
-	if (prev)
-		search = prev;
+	search = prev ? prev : arena->block_list->head;
 
-	block = (block_t *)search->info;
+	block_t *block = (block_t *)search->info;
 	// add first, but in the blocks concatenate case, before search
 	if (!prev) {
 		if (address + size > block->start_address) {
-			printf("This zone was already allocated.\n");
+			out_str("This zone was already allocated.\n");
 			return;
 		}
 		// add first at the search miniblock_list
@@ -121,9 +146,10 @@ void alloc_block(arena_t *arena, const uint64_t address, const uint64_t size)
 				exit(1);
 			}
 			miniblock->start_address = address, miniblock->size = size;
-			miniblock->perm = DEF_PERM, miniblock->rw_buffer = malloc(size);
+			miniblock->perm = DEF_PERM, miniblock->rw_buffer = pool_take(arena, address, size, buf);
 			add_nth_node(block->miniblock_list, 0, (const void *)miniblock);
 			free(miniblock);
+			arena->used_mem += size, arena->num_miniblocks++;
 			return;
 		}
 	}
@@ -131,7 +157,7 @@ void alloc_block(arena_t *arena, const uint64_t address, const uint64_t size)
 	// add last, after search
 	if (!search->next) {
 		if (block->start_address + block->size > address) {
-			printf("This zone was already allocated.\n");
+			out_str("This zone was already allocated.\n");
 			return;
 		}
 		if (block->start_address + block->size == address) {
@@ -142,10 +168,11 @@ void alloc_block(arena_t *arena, const uint64_t address, const uint64_t size)
 				exit(1);
 			}
 			miniblock->start_address = address, miniblock->size = size;
-			miniblock->perm = DEF_PERM, miniblock->rw_buffer = malloc(size);
+			miniblock->perm = DEF_PERM, miniblock->rw_buffer = pool_take(arena, address, size, buf);
 			uint64_t n = block->miniblock_list->num_nodes;
 			add_nth_node(block->miniblock_list, n + 1, (const void *)miniblock);
 			free(miniblock);
+			arena->used_mem += size, arena->num_miniblocks++;
 			return;
 		}
 		block_t *new_block = malloc(sizeof(*new_block));
@@ -161,12 +188,13 @@ void alloc_block(arena_t *arena, const uint64_t address, const uint64_t size)
 			exit(1);
 		}
 		miniblock->start_address = address, miniblock->size = size;
-		miniblock->perm = DEF_PERM, miniblock->rw_buffer = malloc(size);
+		miniblock->perm = DEF_PERM, miniblock->rw_buffer = pool_take(arena, address, size, buf);
 		add_nth_node(new_block->miniblock_list, 0, (const void *)miniblock);
 		free(miniblock);
-		uint64_t n = arena->block_list->num_nodes;
-		add_nth_node(arena->block_list, n + 1, (const void *)new_block);
+		block_index_insert(arena, add_node_after(arena->block_list, search,
+											   (const void *)new_block));
 		free(new_block);
+		arena->used_mem += size, arena->num_miniblocks++;
 		return;
 	}
 
@@ -176,7 +204,7 @@ void alloc_block(arena_t *arena, const uint64_t address, const uint64_t size)
 	block_t *block_n = (block_t *)next->info;
 	if (block->start_address + block->size > address ||
 		address + size > block_n->start_address) {
-		printf("This zone was already allocated.\n");
+		out_str("This zone was already allocated.\n");
 		return;
 	}
 	/* Method: add the miniblock to block->miniblock_list
@@ -195,7 +223,7 @@ void alloc_block(arena_t *arena, const uint64_t address, const uint64_t size)
 			exit(1);
 		}
 		miniblock->start_address = address, miniblock->size = size;
-		miniblock->perm = DEF_PERM, miniblock->rw_buffer = malloc(size);
+		miniblock->perm = DEF_PERM, miniblock->rw_buffer = pool_take(arena, address, size, buf);
 		uint64_t n = block->miniblock_list->num_nodes;
 		add_nth_node(block->miniblock_list, n + 1, (const void *)miniblock);
 		free(miniblock);
@@ -208,6 +236,7 @@ void alloc_block(arena_t *arena, const uint64_t address, const uint64_t size)
 		msearch->next = block_n->miniblock_list->head;
 		block_n->miniblock_list->head->prev = msearch;
 		// delete block_n
+		block_index_remove(arena, next);
 		free(block_n->miniblock_list);
 		free(block_n);
 		search->next = next2;
@@ -216,6 +245,7 @@ void alloc_block(arena_t *arena, const uint64_t address, const uint64_t size)
 		free(next);
 		// updating the number of blocks
 		arena->block_list->num_nodes--;
+		arena->used_mem += size, arena->num_miniblocks++;
 		return;
 	}
 
@@ -228,10 +258,11 @@ void alloc_block(arena_t *arena, const uint64_t address, const uint64_t size)
 			exit(1);
 		}
 		miniblock->start_address = address, miniblock->size = size;
-		miniblock->perm = DEF_PERM, miniblock->rw_buffer = malloc(size);
+		miniblock->perm = DEF_PERM, miniblock->rw_buffer = pool_take(arena, address, size, buf);
 		uint64_t n = block->miniblock_list->num_nodes;
 		add_nth_node(block->miniblock_list, n + 1, (const void *)miniblock);
 		free(miniblock);
+		arena->used_mem += size, arena->num_miniblocks++;
 		return;
 	}
 
@@ -245,9 +276,10 @@ void alloc_block(arena_t *arena, const uint64_t address, const uint64_t size)
 			exit(1);
 		}
 		miniblock->start_address = address, miniblock->size = size;
-		miniblock->perm = DEF_PERM, miniblock->rw_buffer = malloc(size);
+		miniblock->perm = DEF_PERM, miniblock->rw_buffer = pool_take(arena, address, size, buf);
 		add_nth_node(block_n->miniblock_list, 0, (const void *)miniblock);
 		free(miniblock);
+		arena->used_mem += size, arena->num_miniblocks++;
 		return;
 	}
 
@@ -270,7 +302,7 @@ void alloc_block(arena_t *arena, const uint64_t address, const uint64_t size)
 		exit(1);
 	}
 	miniblock->start_address = address, miniblock->size = size;
-	miniblock->perm = DEF_PERM, miniblock->rw_buffer = malloc(size);
+	miniblock->perm = DEF_PERM, miniblock->rw_buffer = pool_take(arena, address, size, buf);
 	add_nth_node(new_block->miniblock_list, 0, (const void *)miniblock);
 	free(miniblock);
 	// adding block info after creating miniblock list
@@ -280,13 +312,15 @@ void alloc_block(arena_t *arena, const uint64_t address, const uint64_t size)
 	search->next = new_node;
 	new_node->prev = search;
 	arena->block_list->num_nodes++;
+	block_index_insert(arena, new_node);
+	arena->used_mem += size, arena->num_miniblocks++;
 }
 
 // frees a miniblock
 void free_m_node(node_t *m_node)
 {
 	miniblock_t *miniblock = (miniblock_t *)m_node->info;
-	free(miniblock->rw_buffer);
+	pool_free(miniblock->rw_buffer, miniblock->size);
 	free(miniblock);
 	free(m_node);
 }
@@ -303,17 +337,11 @@ void free_b_node(node_t *b_node)
 // Deleting a miniblock from the memory; split if the miniblock is not at bounds
 void free_block(arena_t *arena, const uint64_t address)
 {
-	node_t *bsearch = arena->block_list->head;
+	node_t *bsearch = block_index_floor(arena, address, NULL);
 	bool valid = false;
-	uint64_t idx = 0;
-	while (bsearch) {
+	if (bsearch) {
 		block_t *block = (block_t *)bsearch->info;
-		if (block->start_address <= address &&
-			address <= block->start_address + block->size) {
-			valid = true;
-			break;
-		}
-		bsearch = bsearch->next, idx++;
+		valid = address <= block->start_address + block->size;
 	}
 	if (valid) {
 		block_t *block = (block_t *)bsearch->info;
@@ -326,9 +354,11 @@ void free_block(arena_t *arena, const uint64_t address)
 			miniblock_t *miniblock = (miniblock_t *)msearch->info;
 			block->start_address += miniblock->size;
 			block->size -= miniblock->size;
+			arena->used_mem -= miniblock->size, arena->num_miniblocks--;
 			free_m_node(msearch);
 			if (block->miniblock_list->num_nodes == 0) {
-				bsearch = remove_nth_node(arena->block_list, idx);
+				block_index_remove(arena, bsearch);
+				remove_node(arena->block_list, bsearch);
 				free_b_node(bsearch);
 			}
 			return;
@@ -350,6 +380,7 @@ void free_block(arena_t *arena, const uint64_t address)
 			if (!msearch->next) {
 				msearch = remove_nth_node(block->miniblock_list, idx2);
 				block->size -= miniblock->size;
+				arena->used_mem -= miniblock->size, arena->num_miniblocks--;
 				free_m_node(msearch);
 				return;
 			}
@@ -357,6 +388,7 @@ void free_block(arena_t *arena, const uint64_t address)
 			node_t *mprev = msearch->prev, *mnext = msearch->next;
 			msearch = remove_nth_node(block->miniblock_list, idx2);
 			uint64_t right_size = block->size - left_size - miniblock->size;
+			arena->used_mem -= miniblock->size, arena->num_miniblocks--;
 			free_m_node(msearch);
 			uint64_t total_nodes = block->miniblock_list->num_nodes;
 			block->size = left_size, block->miniblock_list->num_nodes = idx2;
@@ -372,30 +404,312 @@ void free_block(arena_t *arena, const uint64_t address)
 			new_block->miniblock_list = dll_create(sizeof(miniblock_t));
 			new_block->miniblock_list->num_nodes = total_nodes - idx2;
 			new_block->miniblock_list->head = mnext;
-			add_nth_node(arena->block_list, idx + 1, (const void *)new_block);
+			block_index_insert(arena, add_node_after(arena->block_list, bsearch,
+												   (const void *)new_block));
 			free(new_block);
 		} else {
-			printf("Invalid address for free.\n");
+			out_str("Invalid address for free.\n");
 		}
 	} else {
-		printf("Invalid address for free.\n");
+		out_str("Invalid address for free.\n");
 	}
 }
 
-void read(arena_t *arena, uint64_t address, uint64_t size)
+/* Deleting every miniblock placed entirely in [start, end) in one pass over
+the block list. In a block the deleted miniblocks are consecutive, so what
+remains is a left part and a right part; only when both exist the block is
+split, and the new block is linked right after it. */
+void free_range(arena_t *arena, const uint64_t start, const uint64_t end)
 {
+	// the blocks before the one holding start are passed over
+	node_t *bsearch = block_index_floor(arena, start, NULL);
+	if (!bsearch)
+		bsearch = arena->block_list->head;
+	uint64_t freed = 0;
+	while (bsearch && start < end) {
+		node_t *bnext = bsearch->next;
+		block_t *block = (block_t *)bsearch->info;
+		uint64_t block_end = block->start_address + block->size;
+		if (block->start_address >= end)
+			break;
+		if (block_end <= start) {
+			bsearch = bnext;
+			continue;
+		}
+		// left = kept before the deleted run, right = kept after it
+		node_t *msearch = block->miniblock_list->head;
+		node_t *left_last = NULL, *first = NULL, *last = NULL;
+		uint64_t left_nodes = 0, nodes = 0;
+		while (msearch) {
+			miniblock_t *miniblock = (miniblock_t *)msearch->info;
+			if (miniblock->start_address >= start &&
+				miniblock->start_address + miniblock->size <= end) {
+				if (!first)
+					first = msearch;
+				last = msearch, nodes++;
+			} else if (first) {
+				break;
+			} else {
+				left_last = msearch, left_nodes++;
+			}
+			msearch = msearch->next;
+		}
+		if (!first) {
+			bsearch = bnext;
+			continue;
+		}
+		node_t *right = last->next;
+		uint64_t right_nodes = block->miniblock_list->num_nodes - left_nodes -
+							   nodes;
+		last->next = NULL;
+		if (left_last)
+			left_last->next = NULL;
+		if (right)
+			right->prev = NULL;
+
+		// releasing the deleted miniblocks
+		while (first) {
+			node_t *mnext = first->next;
+			miniblock_t *miniblock = (miniblock_t *)first->info;
+			arena->used_mem -= miniblock->size, arena->num_miniblocks--;
+			freed++;
+			free_m_node(first);
+			first = mnext;
+		}
+
+		if (!left_last && !right) {
+			// nothing left, the block is unlinked
+			block->miniblock_list->head = NULL;
+			block_index_remove(arena, bsearch);
+			remove_node(arena->block_list, bsearch);
+			free_b_node(bsearch);
+		} else if (!left_last) {
+			miniblock_t *mb_right = (miniblock_t *)right->info;
+			block->start_address = mb_right->start_address;
+			block->size = block_end - block->start_address;
+			block->miniblock_list->head = right;
+			block->miniblock_list->num_nodes = right_nodes;
+		} else {
+			miniblock_t *mb_left = (miniblock_t *)left_last->info;
+			block->size = mb_left->start_address + mb_left->size -
+						  block->start_address;
+			block->miniblock_list->num_nodes = left_nodes;
+			if (right) {
+				// split: the right part becomes a new block after bsearch
+				block_t *new_block = malloc(sizeof(*new_block));
+				if (!new_block) {
+					fprintf(stderr, "Malloc failed!\n");
+					exit(1);
+				}
+				miniblock_t *mb_right = (miniblock_t *)right->info;
+				new_block->start_address = mb_right->start_address;
+				new_block->size = block_end - new_block->start_address;
+				new_block->miniblock_list = dll_create(sizeof(miniblock_t));
+				new_block->miniblock_list->head = right;
+				new_block->miniblock_list->num_nodes = right_nodes;
+				block_index_insert(arena, add_node_after(arena->block_list,
+							bsearch, (const void *)new_block));
+				free(new_block);
+			}
+		}
+		bsearch = bnext;
+	}
+	if (!freed)
+		out_str("Invalid range for free.\n");
+}
+
+// first address of a free zone of the arena with at least size bytes
+bool find_free_zone(const arena_t *arena, uint64_t size, uint64_t *address)
+{
+	uint64_t prev_end = 0;
 	node_t *bsearch = arena->block_list->head;
-	bool ok = false;
-	block_t *block;
 	while (bsearch) {
-		block = (block_t *)bsearch->info;
-		if (block->start_address <= address && block->start_address +
-		block->size > address) {
-			ok = true;
-			break;
+		block_t *block = (block_t *)bsearch->info;
+		if (block->start_address - prev_end >= size) {
+			*address = prev_end;
+			return true;
 		}
+		prev_end = block->start_address + block->size;
 		bsearch = bsearch->next;
 	}
+	if (arena->arena_size - prev_end >= size) {
+		*address = prev_end;
+		return true;
+	}
+	return false;
+}
+
+/* Changing the size of a miniblock: the tail is trimmed (splitting the block
+if other miniblocks follow), the last miniblock of a block grows in the free
+zone after it, otherwise the data moves to the first free zone that fits */
+void realloc_block(arena_t *arena, const uint64_t address,
+				   const uint64_t new_size)
+{
+	node_t *bsearch = block_index_floor(arena, address, NULL), *msearch = NULL;
+	block_t *block;
+	miniblock_t *miniblock;
+	uint64_t idx2 = 0;
+	if (bsearch) {
+		block = (block_t *)bsearch->info;
+		if (address >= block->start_address + block->size)
+			bsearch = NULL;
+	}
+	if (bsearch) {
+		msearch = block->miniblock_list->head;
+		while (msearch) {
+			miniblock = (miniblock_t *)msearch->info;
+			if (miniblock->start_address == address)
+				break;
+			msearch = msearch->next, idx2++;
+		}
+	}
+	if (!msearch) {
+		out_str("Invalid address for realloc.\n");
+		return;
+	}
+	if (new_size == 0) {
+		out_str("Invalid size for realloc.\n");
+		return;
+	}
+	uint64_t old_size = miniblock->size;
+	uint64_t block_end = block->start_address + block->size;
+
+	// trim the tail; the miniblocks after it form a new block
+	if (new_size <= old_size) {
+		miniblock->rw_buffer = pool_resize(miniblock->rw_buffer, old_size,
+										   new_size);
+		miniblock->size = new_size;
+		arena->used_mem -= old_size - new_size;
+		if (msearch->next && new_size != old_size) {
+			node_t *mnext = msearch->next;
+			uint64_t total_nodes = block->miniblock_list->num_nodes;
+			block->size = address + new_size - block->start_address;
+			block->miniblock_list->num_nodes = idx2 + 1;
+			msearch->next = NULL, mnext->prev = NULL;
+			block_t *new_block = malloc(sizeof(*new_block));
+			if (!new_block) {
+				fprintf(stderr, "Malloc failed!\n");
+				exit(1);
+			}
+			miniblock_t *mb_next = (miniblock_t *)mnext->info;
+			new_block->start_address = mb_next->start_address;
+			new_block->size = block_end - mb_next->start_address;
+			new_block->miniblock_list = dll_create(sizeof(miniblock_t));
+			new_block->miniblock_list->num_nodes = total_nodes - idx2 - 1;
+			new_block->miniblock_list->head = mnext;
+			block_index_insert(arena, add_node_after(arena->block_list, bsearch,
+												   (const void *)new_block));
+			free(new_block);
+		} else {
+			block->size -= old_size - new_size;
+		}
+		out_str("Block resized in place.\n");
+		return;
+	}
+
+	// grow in place, the free zone after the block is enough
+	uint64_t limit = arena->arena_size;
+	block_t *block_n = NULL;
+	if (bsearch->next) {
+		block_n = (block_t *)bsearch->next->info;
+		limit = block_n->start_address;
+	}
+	if (!msearch->next && limit - block_end >= new_size - old_size) {
+		miniblock->rw_buffer = pool_resize(miniblock->rw_buffer, old_size,
+										   new_size);
+		miniblock->size = new_size;
+		block->size += new_size - old_size;
+		arena->used_mem += new_size - old_size;
+		// the block reached the next one: miniblock_list union
+		if (block_n && address + new_size == block_n->start_address) {
+			node_t *next = bsearch->next;
+			block->size += block_n->size;
+			block->miniblock_list->num_nodes +=
+				block_n->miniblock_list->num_nodes;
+			msearch->next = block_n->miniblock_list->head;
+			block_n->miniblock_list->head->prev = msearch;
+			bsearch->next = next->next;
+			if (next->next)
+				next->next->prev = bsearch;
+			block_index_remove(arena, next);
+			free_b_node(next);
+			arena->block_list->num_nodes--;
+		}
+		out_str("Block resized in place.\n");
+		return;
+	}
+
+	/* relocation: the old miniblock is freed first, so its zone counts in the
+	search; free_block releases a NULL buffer, the data is kept */
+	void *data = miniblock->rw_buffer;
+	uint8_t old_perm = miniblock->perm;
+	uint64_t new_address;
+	miniblock->rw_buffer = NULL;
+	free_block(arena, address);
+	bool found = find_free_zone(arena, new_size, &new_address);
+	if (found) {
+		data = pool_relocate(arena, data, new_address, old_size, new_size);
+		alloc_block_buf(arena, new_address, new_size, data);
+	} else {
+		// back in its place, with the same buffer
+		new_address = address;
+		alloc_block_buf(arena, address, old_size, data);
+	}
+	miniblock = (miniblock_t *)find_m_node(arena, new_address)->info;
+	miniblock->perm = old_perm;
+	if (!found)
+		out_str("Not enough free memory for realloc.\n");
+	else if (new_address == address)
+		out_str("Block resized in place.\n");
+	else
+		out_str("Block moved to 0x"), out_hex(new_address), out_str(".\n");
+}
+
+// node of the miniblock starting exactly at address, NULL if there is none
+node_t *find_m_node(const arena_t *arena, const uint64_t address)
+{
+	node_t *bsearch = block_index_floor(arena, address, NULL);
+	if (!bsearch)
+		return NULL;
+	block_t *block = (block_t *)bsearch->info;
+	if (address >= block->start_address + block->size)
+		return NULL;
+	node_t *msearch = block->miniblock_list->head;
+	while (msearch) {
+		miniblock_t *miniblock = (miniblock_t *)msearch->info;
+		if (miniblock->start_address == address)
+			return msearch;
+		msearch = msearch->next;
+	}
+	return NULL;
+}
+
+/* Single pass over the miniblocks from m_node to the end of its block: stops
+at the first one that lacks a bit of mask, otherwise total is the sum of the
+visited sizes. Shared by read and write. */
+bool check_perm_range(node_t *m_node, uint8_t mask, uint64_t *total)
+{
+	uint64_t sum = 0;
+	while (m_node) {
+		miniblock_t *miniblock = (miniblock_t *)m_node->info;
+		if ((miniblock->perm & mask) != mask)
+			return false;
+		sum += miniblock->size;
+		m_node = m_node->next;
+	}
+	*total = sum;
+	return true;
+}
+
+void read(arena_t *arena, uint64_t address, uint64_t size)
+{
+	node_t *bsearch = block_index_floor(arena, address, NULL);
+	bool ok = false;
+	block_t *block;
+	if (bsearch) {
+		block = (block_t *)bsearch->info;
+		ok = block->start_address + block->size > address;
+	}
 	if (ok) {
 		ok = false;
 		node_t *msearch = block->miniblock_list->head;
@@ -411,23 +725,17 @@ void read(arena_t *arena, uint64_t address, uint64_t size)
 		}
 		if (ok) {
 			bool good_size = true;
-			node_t *mnode = msearch;
-			miniblock_t *mb_tmp;
-			uint64_t check_size = 0;
-			while (mnode) {
-				mb_tmp = (miniblock_t *)mnode->info;
-				check_size += mb_tmp->size;
-				uint8_t perm = mb_tmp->perm;
-				// no read permission
-				if (perm < 4) {
-					printf("Invalid permissions for read.\n");
-					return;
-				}
-				mnode = mnode->next;
+			node_t *mnode;
+			uint64_t check_size;
+			// no read permission
+			if (!check_perm_range(msearch, PERM_READ, &check_size)) {
+				out_str("Invalid permissions for read.\n");
+				return;
 			}
 			if (check_size < size) {
-				printf("Warning: size was bigger than the block size. ");
-				printf("Reading %lu characters.\n", check_size);
+				out_str("Warning: size was bigger than the block size. ");
+				out_str("Reading "), out_dec(check_size);
+				out_str(" characters.\n");
 				good_size = false;
 			}
 			if (good_size)
@@ -441,40 +749,32 @@ void read(arena_t *arena, uint64_t address, uint64_t size)
 				uint64_t j = 0; // buffer index
 				if (address > miniblock->start_address)
 					j = address - miniblock->start_address;
-				while (j < miniblock->size) {
-					// case for single words
-					if (idx == check_size) {
-						printf("\n");
-						return;
-					}
-					printf("%c", ((char *)miniblock->rw_buffer)[j]);
-					j++, idx++;
-				}
+				// the whole span of the miniblock is copied at once
+				uint64_t len = miniblock->size - j;
+				if (len > check_size - idx)
+					len = check_size - idx;
+				out_mem((char *)miniblock->rw_buffer + j, len);
+				idx += len;
 				mnode = mnode->next;
 			}
-			printf("\n");
+			out_char('\n');
 		} else {
-			printf("Invalid address for read.\n");
+			out_str("Invalid address for read.\n");
 		}
 	} else {
-		printf("Invalid address for read.\n");
+		out_str("Invalid address for read.\n");
 	}
 }
 
 void write(arena_t *arena, const uint64_t address,
 		   const uint64_t size, char *data)
 {
-	node_t *bsearch = arena->block_list->head;
+	node_t *bsearch = block_index_floor(arena, address, NULL);
 	bool ok = false;
 	block_t *block;
-	while (bsearch) {
+	if (bsearch) {
 		block = (block_t *)bsearch->info;
-		if (block->start_address <= address && block->start_address +
-		block->size > address) {
-			ok = true;
-			break;
-		}
-		bsearch = bsearch->next;
+		ok = block->start_address + block->size > address;
 	}
 	if (ok) {
 		ok = false;
@@ -491,23 +791,17 @@ void write(arena_t *arena, const uint64_t address,
 		}
 		if (ok) {
 			bool good_size = true;
-			node_t *mnode = msearch;
-			miniblock_t *mb_tmp;
-			uint64_t check_size = 0;
-			while (mnode) {
-				mb_tmp = (miniblock_t *)mnode->info;
-				check_size += mb_tmp->size;
-				uint8_t perm = mb_tmp->perm;
-				// no write permission
-				if (perm != 2 && perm != 3 && perm != 6 && perm != 7) {
-					printf("Invalid permissions for write.\n");
-					return;
-				}
-				mnode = mnode->next;
+			node_t *mnode;
+			uint64_t check_size;
+			// no write permission
+			if (!check_perm_range(msearch, PERM_WRITE, &check_size)) {
+				out_str("Invalid permissions for write.\n");
+				return;
 			}
 			if (check_size < size) {
-				printf("Warning: size was bigger than the block size. ");
-				printf("Writing %lu characters.\n", check_size);
+				out_str("Warning: size was bigger than the block size. ");
+				out_str("Writing "), out_dec(check_size);
+				out_str(" characters.\n");
 				good_size = false;
 			}
 			if (good_size)
@@ -515,114 +809,108 @@ void write(arena_t *arena, const uint64_t address,
 			// Writing method:
 			uint64_t idx = 0; //index for data string
 			mnode = msearch;
-			while (idx < check_size) {
+			// check_size counts the whole first miniblock, so mnode can end first
+			while (idx < check_size && mnode) {
 				// bigger addres for miniblock possibility
 				miniblock = (miniblock_t *)mnode->info;
 				uint64_t j = 0; // buffer index
 				if (address > miniblock->start_address)
 					j = address - miniblock->start_address;
-				while (j < miniblock->size) {
+				while (j < miniblock->size && idx < check_size) {
 					((char *)miniblock->rw_buffer)[j] = data[idx];
 					j++, idx++;
 				}
 				mnode = mnode->next;
 			}
 		} else {
-			printf("Invalid address for write.\n");
+			out_str("Invalid address for write.\n");
 		}
 	} else {
-		printf("Invalid address for write.\n");
+		out_str("Invalid address for write.\n");
 	}
 }
 
-// unsigned int mask to char* perm; result will be freed after used
-// rule of convertion is the same as permissions of files
-char *perm(uint8_t mask)
+// simplified memory visualization
+void pmap(const arena_t *arena)
 {
-	char *p = malloc(5);
-	if (!p) {
-		fprintf(stderr, "Malloc failed!\n");
-		exit(1);
-	}
-	switch (mask) {
-	case 0:
-		strcpy(p, "---");
-		break;
-	case 1:
-		strcpy(p, "--X");
-		break;
-	case 2:
-		strcpy(p, "-W-");
-		break;
-	case 3:
-		strcpy(p, "-WX");
-		break;
-	case 4:
-		strcpy(p, "R--");
-		break;
-	case 5:
-		strcpy(p, "R-X");
-		break;
-	case 6:
-		strcpy(p, "RW-");
-		break;
-	case 7:
-		strcpy(p, "RWX");
-		break;
-	}
-	return p;
+	pmap_range(arena, 0, arena->arena_size, 0);
 }
 
-// simplified memory visualization
-void pmap(const arena_t *arena)
+/* Memory visualization restricted to the miniblocks that overlap
+[start, end); limit != 0 caps the number of printed miniblocks and, when the
+window holds more, the line "Next: 0x..." gives the start of the next page */
+void pmap_range(const arena_t *arena, uint64_t start, uint64_t end,
+				uint64_t limit)
 {
-	uint64_t free_mem = arena->arena_size, num_miniblocks = 0;
-	// uint64_t can be printed in hex format using lx format specifier
-	printf("Total memory: 0x%lX bytes\n", arena->arena_size);
-	node_t *bsearch = arena->block_list->head;
+	// the totals are kept up to date by alloc_block and free_block
+	out_str("Total memory: 0x"), out_hex(arena->arena_size);
+	out_str(" bytes\n");
+	out_str("Free memory: 0x"), out_hex(arena->arena_size - arena->used_mem);
+	out_str(" bytes\n");
+	out_str("Number of allocated blocks: ");
+	out_dec(arena->block_list->num_nodes);
+	out_str("\nNumber of allocated miniblocks: ");
+	out_dec(arena->num_miniblocks), out_char('\n');
 
-	// calculating free_memory and number of miniblocks
-	// free_size is calcultated: total_memory - sum(block_i_size)
-	while (bsearch) {
+	uint64_t i = 0, j, printed = 0;
+	// i = index of block node, j = index of miniblock node
+	node_t *bsearch = block_index_floor(arena, start, &i);
+
+	// skipping whole blocks placed before the window, without their miniblocks
+	if (!bsearch) {
+		bsearch = arena->block_list->head;
+	} else {
 		block_t *block = (block_t *)bsearch->info;
-		num_miniblocks += block->miniblock_list->num_nodes;
-		free_mem -= block->size;
-		bsearch = bsearch->next;
+		if (block->start_address + block->size <= start)
+			bsearch = bsearch->next, i++;
 	}
-
-	printf("Free memory: 0x%lX bytes\n", free_mem);
-	printf("Number of allocated blocks: %lu\n", arena->block_list->num_nodes);
-	if (arena->block_list->num_nodes != 0)
-		printf("Number of allocated miniblocks: %lu\n\n", num_miniblocks);
-	else
-		printf("Number of allocated miniblocks: %lu\n", num_miniblocks);
-	int i = 1, j;
-	// i = index of block node, j = index of miniblock node
-	bsearch = arena->block_list->head;
+	i++;
 
 	// traversing lists and showing the info in the required format
 	while (bsearch) {
 		block_t *block = (block_t *)bsearch->info;
-		printf("Block %d begin\n", i);
-		printf("Zone: 0x%lX - 0x%lX\n", block->start_address,
-			   block->start_address + block->size);
+		if (block->start_address >= end)
+			break;
+		out_str("\nBlock "), out_dec(i), out_str(" begin\n");
+		out_str("Zone: 0x"), out_hex(block->start_address);
+		out_str(" - 0x"), out_hex(block->start_address + block->size);
+		out_char('\n');
 		node_t *msearch = block->miniblock_list->head;
 		j = 1;
 		while (msearch) {
 			miniblock_t *miniblock = (miniblock_t *)msearch->info;
-			printf("Miniblock %d:\t\t0x%lX\t\t-", j, miniblock->start_address);
-			printf("\t\t0x%lX\t\t", miniblock->start_address + miniblock->size);
-			char *p = perm(miniblock->perm);
-			printf("| %s\n", p);
-			// p was allocated in perm function, but not freed
-			free(p);
+			if (miniblock->start_address >= end)
+				break;
+			if (miniblock->start_address + miniblock->size <= start) {
+				msearch = msearch->next;
+				j++;
+				continue;
+			}
+			if (limit && printed == limit) {
+				out_str("Block "), out_dec(i), out_str(" end\n");
+				out_str("\nNext: 0x"), out_hex(miniblock->start_address);
+				out_char('\n');
+				return;
+			}
+			out_str("Miniblock "), out_dec(j);
+			out_str(":\t\t0x"), out_hex(miniblock->start_address);
+			out_str("\t\t-\t\t0x");
+			out_hex(miniblock->start_address + miniblock->size);
+			out_str("\t\t| "), out_str(perm(miniblock->perm));
+			out_char('\n');
 			msearch = msearch->next;
-			j++;
+			j++, printed++;
+		}
+		out_str("Block "), out_dec(i), out_str(" end\n");
+		// the page was filled exactly at the end of a block
+		if (limit && printed == limit && bsearch->next) {
+			block_t *block_n = (block_t *)bsearch->next->info;
+			if (block_n->start_address < end) {
+				out_str("\nNext: 0x"), out_hex(block_n->start_address);
+				out_char('\n');
+				return;
+			}
 		}
-		if (bsearch->next)
-			printf("Block %d end\n\n", i);
-		else
-			printf("Block %d end\n", i);
 		bsearch = bsearch->next;
 		i++;
 	}
@@ -630,21 +918,16 @@ void pmap(const arena_t *arena)
 
 void mprotect(arena_t *arena, uint64_t address, uint8_t *permission)
 {
-	node_t *bsearch = arena->block_list->head;
+	node_t *bsearch = block_index_floor(arena, address, NULL);
 	bool ok = false;
 	block_t *block;
-	while (bsearch) {
+	if (bsearch) {
 		// valid address since bsearch != NULL
 		block = (block_t *)bsearch->info;
-		if (block->start_address <= address && address <
-			block->start_address + block->size) {
-			ok = true;
-			break;
-		}
-		bsearch = bsearch->next;
+		ok = address < block->start_address + block->size;
 	}
 	if (!ok) {
-		printf("Invalid address for mprotect.\n");
+		out_str("Invalid address for mprotect.\n");
 		return;
 	}
 	ok = false;
@@ -661,7 +944,7 @@ void mprotect(arena_t *arena, uint64_t address, uint8_t *permission)
 		msearch = msearch->next;
 	}
 	if (!ok) {
-		printf("Invalid address for mprotect.\n");
+		out_str("Invalid address for mprotect.\n");
 		return;
 	}
 }
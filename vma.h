@@ -12,10 +12,54 @@
 #include <stdbool.h>
 #include <time.h>
 #include <string.h>
+#include "command.h"
 
 #define MAX_COMMAND 50
 #define MAX_TEXT 500
+// engine variant, chosen at build time (see the Makefile targets):
+// VMA_POOL recycles the rw_buffers, VMA_RECLAIM frees the large ones on a
+// background thread; VMA_HUGEPAGES is in hugepage.h
+#ifndef VMA_POOL
+#define VMA_POOL 1
+#endif
+#ifndef VMA_RECLAIM
+#define VMA_RECLAIM 1
+#endif
+// block container (blockidx.c): VMA_LIST walks the block list, VMA_ARRAY and
+// VMA_TREE find a block by address in a sorted array or a balanced tree
+#define VMA_LIST 0
+#define VMA_ARRAY 1
+#define VMA_TREE 2
+#ifndef VMA_CONTAINER
+#define VMA_CONTAINER VMA_LIST
+#endif
+// rw_buffer backing (pool.c): VMA_MALLOC takes every buffer from the pool,
+// VMA_MMAP maps the arena once and a miniblock's buffer is its zone in it
+#define VMA_MALLOC 0
+#define VMA_MMAP 1
+#ifndef VMA_BACKING
+#define VMA_BACKING VMA_MALLOC
+#endif
+
+// rw_buffer pool: classes POOL_MIN_SIZE << 0 .. POOL_CLASSES - 1
+#define POOL_MIN_SIZE 16
+#define POOL_CLASSES 17
+// upper bound of the memory kept in the pool, in bytes
+#ifndef POOL_CAP
+#define POOL_CAP (64 << 20)
+#endif
+// the bytes of a buffer never written read as zero (fresh, recycled and
+// grown buffers alike), so the output doesn't depend on the heap
+#ifndef POOL_ZERO
+#define POOL_ZERO 0
+#endif
+// buffers waiting for the background reclaimer, at most
+#define RECLAIM_QUEUE 256
 #define DEF_PERM 6
+// permission bits, same rule as the file permissions
+#define PERM_READ 4
+#define PERM_WRITE 2
+#define PERM_EXEC 1
 
 // node for doubly linked list (miniblock or block type)
 typedef struct node_t {
@@ -45,28 +89,129 @@ typedef struct miniblock_t {
 	void *rw_buffer;
 } miniblock_t;
 
+// kinds of undo log entries
+#define UNDO_ALLOC 0
+#define UNDO_FREE 1
+#define UNDO_WRITE 2
+#define UNDO_PERM 3
+
+// one change made in a transaction, with what is needed to revert it
+typedef struct undo_entry_t {
+	uint8_t type;
+	// permission before MPROTECT
+	uint8_t perm;
+	uint64_t address;
+	uint64_t size;
+	/* miniblock changed by WRITE or MPROTECT, or the freed one, kept whole
+	(buffer and permission) until COMMIT or ABORT */
+	miniblock_t *miniblock;
+	// bytes overwritten by WRITE in that miniblock
+	void *data;
+} undo_entry_t;
+
+// lookup structure of the blocks, defined by the VMA_CONTAINER in use
+typedef struct block_index_t block_index_t;
+
 // virtual memory field
 typedef struct arena_t {
 	uint64_t arena_size;
 	list_t *block_list;
+	// NULL with VMA_LIST
+	block_index_t *block_index;
+	// the whole arena with VMA_MMAP, NULL otherwise
+	char *mapping;
+	// totals of the allocated miniblocks, kept for pmap
+	uint64_t used_mem;
+	uint64_t num_miniblocks;
+	// undo log of the open transaction
+	bool in_tx;
+	undo_entry_t *undo_log;
+	uint64_t undo_len;
+	uint64_t undo_cap;
 } arena_t;
 
 // functions for virtual memory representation in the physical memory
-void alloc_arena(const uint64_t size, arena_t *arena);
+bool alloc_arena(const uint64_t size, arena_t *arena);
 void dealloc_arena(arena_t *arena);
 void alloc_block(arena_t *arena, const uint64_t address, const uint64_t size);
+void alloc_block_buf(arena_t *arena, const uint64_t address,
+					 const uint64_t size, void *buf);
 void free_block(arena_t *arena, const uint64_t address);
+node_t *find_m_node(const arena_t *arena, const uint64_t address);
+bool check_perm_range(node_t *m_node, uint8_t mask, uint64_t *total);
+void free_range(arena_t *arena, const uint64_t start, const uint64_t end);
+void realloc_block(arena_t *arena, const uint64_t address,
+				   const uint64_t new_size);
+bool find_free_zone(const arena_t *arena, uint64_t size, uint64_t *address);
 
 // functions for operations on virtual memory
 void read(arena_t *arena, uint64_t address, uint64_t size);
 void write(arena_t *arena, const uint64_t address,
 		   const uint64_t size, char *data);
-char *perm(uint8_t mask);
 void pmap(const arena_t *arena);
+void pmap_range(const arena_t *arena, uint64_t start, uint64_t end,
+				uint64_t limit);
 void mprotect(arena_t *arena, uint64_t address, uint8_t *permission);
 
+// buffered output used instead of printf (the sink is set in command.h)
+void out_flush(void);
+void out_mem(const char *s, uint64_t len);
+void out_str(const char *s);
+void out_char(char c);
+void out_dec(uint64_t x);
+void out_hex(uint64_t x);
+const char *perm(uint8_t mask);
+
+// block lookup by address, kept in step with block_list on every added or
+// removed block node; floor is the last block starting at or before address
+block_index_t *block_index_create(void);
+void block_index_free(arena_t *arena);
+void block_index_insert(arena_t *arena, node_t *b_node);
+void block_index_remove(arena_t *arena, node_t *b_node);
+node_t *block_index_floor(const arena_t *arena, uint64_t address,
+						  uint64_t *pos);
+void block_index_memory(const arena_t *arena, uint64_t *used, uint64_t *heap);
+
+// recycling pool for the rw_buffer allocations
+void *pool_alloc(uint64_t size);
+void pool_free(void *buf, uint64_t size);
+void *pool_resize(void *buf, uint64_t old_size, uint64_t new_size);
+void pool_release(void *buf, uint64_t size);
+void pool_clear(void);
+void pool_stats(uint64_t used_mem, uint64_t arenas);
+uint64_t pool_footprint(uint64_t size);
+void *pool_take(arena_t *arena, uint64_t address, uint64_t size, void *buf);
+void *pool_relocate(arena_t *arena, void *buf, uint64_t new_address,
+					uint64_t old_size, uint64_t new_size);
+void *pool_detach(void *buf, uint64_t size);
+void pool_free_detached(void *buf, uint64_t size);
+
+// memory footprint of the representation
+uint64_t malloc_footprint(uint64_t n);
+void memstat(const arena_t *arena);
+
+// background release of the large buffers
+void reclaim_push(void *buf, uint64_t size);
+void reclaim_drain(void);
+
+// transactions: BEGIN, COMMIT, ABORT and the logged operations
+void tx_begin(arena_t *arena);
+void tx_commit(arena_t *arena);
+void tx_abort(arena_t *arena);
+void tx_alloc_block(arena_t *arena, const uint64_t address,
+					const uint64_t size);
+void tx_free_block(arena_t *arena, const uint64_t address);
+void tx_write(arena_t *arena, const uint64_t address,
+			  const uint64_t size, char *data);
+void tx_mprotect(arena_t *arena, uint64_t address, uint8_t *permission);
+
+// consistency check of the lists, used by the debug build
+bool check_arena(const arena_t *arena);
+
 list_t *dll_create(uint64_t info_size);
 void add_nth_node(list_t *dll, uint64_t n, const void *new_info);
 node_t *remove_nth_node(list_t *dll, uint64_t n);
+node_t *add_node_after(list_t *dll, node_t *prev, const void *new_info);
+void remove_node(list_t *dll, node_t *node);
 
 #endif
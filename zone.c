@@ -0,0 +1,33 @@
+/*
+	Arena mapping: one anonymous mapping of the arena size, without swap
+	reserved, so only the pages touched by the rw_buffers take memory
+*/
+#define _DEFAULT_SOURCE
+#include <stddef.h>
+#include <sys/mman.h>
+#include "zone.h"
+
+#define ZONE_PAGE_SIZE 4096
+
+// NULL when the address space can't hold the arena
+void *zone_map(uint64_t size)
+{
+	void *base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+					  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	return base == MAP_FAILED ? NULL : base;
+}
+
+void zone_unmap(void *base, uint64_t size)
+{
+	munmap(base, size);
+}
+
+// the whole pages of a freed buffer go back to the system, reading as zero
+void zone_discard(void *buf, uint64_t size)
+{
+	uint64_t start = ((uint64_t)buf + ZONE_PAGE_SIZE - 1) &
+					 ~(uint64_t)(ZONE_PAGE_SIZE - 1);
+	uint64_t end = ((uint64_t)buf + size) & ~(uint64_t)(ZONE_PAGE_SIZE - 1);
+	if (start < end)
+		madvise((void *)start, end - start, MADV_DONTNEED);
+}
@@ -0,0 +1,15 @@
+/*
+	Mapping of the whole arena for the VMA_MMAP backing. Kept apart from
+	vma.h, because sys/mman.h declares an mprotect of its own.
+*/
+#ifndef ZONE_H
+#define ZONE_H
+
+#pragma once
+#include <inttypes.h>
+
+void *zone_map(uint64_t size);
+void zone_unmap(void *base, uint64_t size);
+void zone_discard(void *buf, uint64_t size);
+
+#endif